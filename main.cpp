@@ -1,19 +1,55 @@
 // Standard headers
 #include <cassert>
+#include <cctype>
+#include <cerrno>
 #include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 
 #include <string>
 #include <iostream>
+#include <fstream>
 #include <sstream>
+#include <iomanip>
 
 #include <algorithm>
+#include <deque>
 #include <map>
 #include <vector>
 #include <list>
+#include <memory>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// POSIX headers
+#include <dirent.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 // Boost headers
 #include <boost/asio.hpp>
+#include <boost/iostreams/copy.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filtering_streambuf.hpp>
 
 // Spitfire headers
 #include <spitfire/spitfire.h>
@@ -25,7 +61,6 @@
 
 #include <spitfire/storage/file.h>
 #include <spitfire/storage/filesystem.h>
-#include <spitfire/storage/json.h>
 #include <spitfire/storage/xml.h>
 
 #include <spitfire/communication/http.h>
@@ -35,971 +70,4888 @@ typedef spitfire::string_t string_t;
 typedef spitfire::ostringstream_t ostringstream_t;
 
 
-class cReportResult
+// Calls function once for each item in [0, nItems) spread over up to nThreads threads
+void ParallelFor(size_t nThreads, size_t nItems, std::function<void (size_t)> function)
 {
-public:
-  cReportResult();
-
-  const string_t& GetName() const { return sName; }
-  void SetName(const string_t& _sName) { sName = _sName; }
-
-  bool IsNotRun() const { return (state == STATE::NOT_RUN); }
-  bool IsPassed() const { return (state == STATE::PASSED); }
-  bool IsFailed() const { return (state == STATE::FAILED); }
-
-  void SetNotRun() { state = STATE::NOT_RUN; }
-  void SetPassed() { state = STATE::PASSED; }
-  void SetFailed() { state = STATE::FAILED; }
+  nThreads = std::max<size_t>(1, std::min(nThreads, nItems));
 
-private:
-  string_t sName;
-  enum class STATE {
-    NOT_RUN,
-    PASSED,
-    FAILED
+  std::atomic<size_t> next(0);
+  auto Worker = [&]()
+  {
+    for (size_t i = next++; i < nItems; i = next++) function(i);
   };
-  STATE state;
-};
 
-cReportResult::cReportResult() :
-  state(STATE::NOT_RUN)
-{
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < nThreads; i++) workers.push_back(std::thread(Worker));
+  for (size_t i = 0; i < nThreads; i++) workers[i].join();
 }
 
-
-class cReportTarget
+uint64_t GetElapsedMS(const std::chrono::steady_clock::time_point& start)
 {
-public:
-  bool IsSuccess() const;
-
-  const string_t& GetName() const { return sName; }
-  void SetName(const string_t& _sName) { sName = _sName; }
-  const std::vector<cReportResult*>& GetResults() const { return results; }
-
-  void SetTestResultNotRun(const string_t& sTestName);
-  void SetTestResultPassed(const string_t& sTestName);
-  void SetTestResultFailed(const string_t& sTestName);
-
-private:
-  cReportResult* GetOrCreateTest(const string_t& sTestName);
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
 
-  string_t sName;
-  std::vector<cReportResult*> results;
-};
 
-cReportResult* cReportTarget::GetOrCreateTest(const string_t& sTestName)
+// Turn a url or a project name into something that is safe to use as a file or folder name
+string_t GetSafeFileName(const string_t& sName)
 {
-  //std::cout<<"cReportTarget::GetOrCreateTest \""<<spitfire::string::ToUTF8(sTestName)<<"\""<<std::endl;
-  cReportResult* pResult = nullptr;
-
-  // Find the test if it has already been added
-  const size_t n = results.size();
+  string_t sSafeName = sName;
+  const size_t n = sSafeName.length();
   for (size_t i = 0; i < n; i++) {
-    //std::cout<<"cReportTarget::GetOrCreateTest "<<i<<" is "<<spitfire::string::ToUTF8(results[i]->GetName())<<std::endl;
-    if (results[i]->GetName() == sTestName) {
-      //std::cout<<"cReportTarget::GetOrCreateTest Found"<<std::endl;
-      pResult = results[i];
-      break;
-    }
-  }
-
-  // We didn't find the test so we need to create a new one
-  if (pResult == nullptr) {
-    //std::cout<<"cReportTarget::GetOrCreateTest Not found, creating"<<std::endl;
-    pResult = new cReportResult;
-    pResult->SetName(sTestName);
-    pResult->SetNotRun();
-    results.push_back(pResult);
+    if (!isalnum(sSafeName[i]) && (sSafeName[i] != TEXT('.')) && (sSafeName[i] != TEXT('-'))) sSafeName[i] = TEXT('_');
   }
 
-  return pResult;
+  return sSafeName;
 }
 
-void cReportTarget::SetTestResultNotRun(const string_t& sTestName)
+
+// The resources that a step used, a step may be made up of several child processes
+class cResourceUsage
 {
-  cReportResult* pResult = GetOrCreateTest(sTestName);
-  assert(pResult != nullptr);
-  pResult->SetNotRun();
-}
+public:
+  cResourceUsage();
 
-void cReportTarget::SetTestResultPassed(const string_t& sTestName)
+  void Add(const cResourceUsage& rhs);
+
+  uint64_t wallMS;
+  uint64_t userMS;
+  uint64_t systemMS;
+  uint64_t peakRSSKB; // The largest resident set size of the child or any of its descendants
+
+  // Compilations that ccache answered from the cache and that it had to run the compiler for
+  uint64_t compilerCacheHits;
+  uint64_t compilerCacheMisses;
+};
+
+cResourceUsage::cResourceUsage() :
+  wallMS(0),
+  userMS(0),
+  systemMS(0),
+  peakRSSKB(0),
+  compilerCacheHits(0),
+  compilerCacheMisses(0)
 {
-  cReportResult* pResult = GetOrCreateTest(sTestName);
-  assert(pResult != nullptr);
-  pResult->SetPassed();
 }
 
-void cReportTarget::SetTestResultFailed(const string_t& sTestName)
+void cResourceUsage::Add(const cResourceUsage& rhs)
 {
-  cReportResult* pResult = GetOrCreateTest(sTestName);
-  assert(pResult != nullptr);
-  pResult->SetFailed();
+  wallMS += rhs.wallMS;
+  userMS += rhs.userMS;
+  systemMS += rhs.systemMS;
+  peakRSSKB = std::max(peakRSSKB, rhs.peakRSSKB);
+  compilerCacheHits += rhs.compilerCacheHits;
+  compilerCacheMisses += rhs.compilerCacheMisses;
 }
 
 
+extern char** environ;
 
-
-class cReportProject
+// Keeps the last nCapacity bytes written to it, so we can hold on to the end of a child's output however much it prints
+class cOutputTail
 {
 public:
-  explicit cReportProject(const string_t& sName);
+  explicit cOutputTail(size_t nCapacity);
 
-  bool IsSuccess() const;
-
-  // Project
-  const string_t& GetName() const { return sName; }
-  const std::vector<cReportResult*>& GetResults() const { return results; }
-  void SetTestResultNotRun(const string_t& sTestName);
-  void SetTestResultPassed(const string_t& sTestName);
-  void SetTestResultFailed(const string_t& sTestName);
+  void Append(const char* pData, size_t nBytes);
 
-  // Target
-  const std::vector<cReportTarget*>& GetTargets() const { return targets; }
-  void SetTestResultNotRun(const string_t& sTarget, const string_t& sTestName);
-  void SetTestResultPassed(const string_t& sTarget, const string_t& sTestName);
-  void SetTestResultFailed(const string_t& sTarget, const string_t& sTestName);
+  std::string GetString() const;
 
 private:
-  cReportResult* GetOrCreateTest(const string_t& sTestName);
-
-  cReportTarget* GetOrCreateTarget(const string_t& sName);
-
-  string_t sName;
-  std::vector<cReportResult*> results;
-  std::vector<cReportTarget*> targets;
+  std::vector<char> buffer;
+  size_t next;
+  bool bIsFull;
 };
 
-cReportProject::cReportProject(const string_t& _sName) :
-  sName(_sName)
+cOutputTail::cOutputTail(size_t nCapacity) :
+  buffer(std::max<size_t>(1, nCapacity)),
+  next(0),
+  bIsFull(false)
 {
 }
 
-cReportResult* cReportProject::GetOrCreateTest(const string_t& sTestName)
+void cOutputTail::Append(const char* pData, size_t nBytes)
 {
-  //std::cout<<"cReportProject::GetOrCreateTest \""<<spitfire::string::ToUTF8(sTestName)<<"\""<<std::endl;
-  cReportResult* pResult = nullptr;
+  const size_t nCapacity = buffer.size();
 
-  // Find the test if it has already been added
-  const size_t n = results.size();
-  for (size_t i = 0; i < n; i++) {
-    //std::cout<<"cReportProject::GetOrCreateTest "<<i<<" is "<<spitfire::string::ToUTF8(results[i]->GetName())<<std::endl;
-    if (results[i]->GetName() == sTestName) {
-      //std::cout<<"cReportProject::GetOrCreateTest Found"<<std::endl;
-      pResult = results[i];
-      break;
-    }
+  // Only the end of a large write can survive anyway
+  if (nBytes > nCapacity) {
+    pData += nBytes - nCapacity;
+    nBytes = nCapacity;
   }
 
-  // We didn't find the test so we need to create a new one
-  if (pResult == nullptr) {
-    //std::cout<<"cReportProject::GetOrCreateTest Not found, creating"<<std::endl;
-    pResult = new cReportResult;
-    pResult->SetName(sTestName);
-    pResult->SetNotRun();
-    results.push_back(pResult);
+  for (size_t i = 0; i < nBytes; i++) {
+    buffer[next] = pData[i];
+    next++;
+    if (next == nCapacity) {
+      next = 0;
+      bIsFull = true;
+    }
   }
+}
 
-  return pResult;
+std::string cOutputTail::GetString() const
+{
+  if (!bIsFull) return std::string(&buffer[0], next);
+
+  std::string sOutput(&buffer[next], buffer.size() - next);
+  sOutput.append(&buffer[0], next);
+  return sOutput;
 }
 
-cReportTarget* cReportProject::GetOrCreateTarget(const string_t& sName)
+// Runs a child process in its own working folder with its own arguments and environment
+// Nothing about our process is changed (Unlike chdir or setenv) so several children can be started at once from different threads
+class cChildProcess
 {
-  //std::cout<<"cReportProject::GetOrCreateTarget \""<<spitfire::string::ToUTF8(sName)<<"\""<<std::endl;
-  cReportTarget* pTarget = nullptr;
+public:
+  cChildProcess();
 
-  // Find the test if it has already been added
-  const size_t n = targets.size();
-  for (size_t i = 0; i < n; i++) {
-    //std::cout<<"cReportProject::GetOrCreateTarget "<<i<<" is "<<spitfire::string::ToUTF8(targets[i]->GetName())<<std::endl;
-    if (targets[i]->GetName() == sName) {
-      //std::cout<<"cReportProject::GetOrCreateTarget Found"<<std::endl;
-      pTarget = targets[i];
-      break;
-    }
-  }
+  void SetWorkingFolder(const string_t& sWorkingFolder);
+  void AddArgument(const string_t& sArgument); // The first argument is the executable, it is searched for in PATH
+  void SetEnvironmentVariable(const string_t& sName, const string_t& sValue); // Overrides or adds to the environment of our process
+  void AddInheritedFileDescriptor(int fd); // Our file descriptors are closed in the child unless they are added here
+  void SetLogFile(const string_t& sLogFilePath, bool bAppend); // Where the whole output of the child is streamed to as it runs
+  void SetTimeoutMS(uint64_t timeoutMS); // The child is started in its own process group, which is killed if it runs for longer than this
+  void SetCancelFlag(const std::atomic<bool>& bIsCancelled); // The child is started in its own process group, which is killed as soon as the flag is set
 
-  // We didn't find the test so we need to create a new one
-  if (pTarget == nullptr) {
-    //std::cout<<"cReportProject::GetOrCreateTarget Not found, creating"<<std::endl;
-    pTarget = new cReportTarget;
-    pTarget->SetName(sName);
-    targets.push_back(pTarget);
-  }
+  string_t GetCommandLine() const;
 
-  return pTarget;
+  // Waits for the child to exit and returns its exit code
+  // stdout and stderr are written to the log file as they arrive, only the last nOutputTailBytes are kept in sOutput
+  // Returns iReturnCodeTimedOut if the child was killed because it ran for longer than the timeout, and iReturnCodeCancelled if it was killed
+  // or never started because the cancel flag was set
+  int Run(std::string& sOutput) const;
+  int Run(std::string& sOutput, cResourceUsage& usage) const;
+
+  static const size_t nOutputTailBytes = 16 * 1024;
+  static const int iReturnCodeTimedOut = -2;
+  static const int iReturnCodeCancelled = -3;
+
+private:
+  static const uint64_t killedOutputTimeoutMS = 5000; // How long we wait for the pipe to close after killing the process group
+  static const uint64_t cancelPollIntervalMS = 100; // How often we check the cancel flag while the child is running
+
+  string_t sWorkingFolder;
+  string_t sLogFilePath;
+  bool bAppendToLogFile;
+  uint64_t timeoutMS; // 0 for no timeout
+  const std::atomic<bool>* pIsCancelled; // nullptr if the child can't be cancelled
+  std::vector<string_t> arguments;
+  std::map<std::string, std::string> environment;
+  std::vector<int> inheritedFileDescriptors;
+};
+
+cChildProcess::cChildProcess() :
+  bAppendToLogFile(false),
+  timeoutMS(0),
+  pIsCancelled(nullptr)
+{
 }
 
-void cReportProject::SetTestResultNotRun(const string_t& sTestName)
+void cChildProcess::SetWorkingFolder(const string_t& _sWorkingFolder)
 {
-  cReportResult* pResult = GetOrCreateTest(sTestName);
-  assert(pResult != nullptr);
-  pResult->SetNotRun();
+  sWorkingFolder = _sWorkingFolder;
 }
 
-void cReportProject::SetTestResultPassed(const string_t& sTestName)
+void cChildProcess::AddArgument(const string_t& sArgument)
 {
-  cReportResult* pResult = GetOrCreateTest(sTestName);
-  assert(pResult != nullptr);
-  pResult->SetPassed();
+  arguments.push_back(sArgument);
 }
 
-void cReportProject::SetTestResultFailed(const string_t& sTestName)
+void cChildProcess::SetEnvironmentVariable(const string_t& sName, const string_t& sValue)
 {
-  cReportResult* pResult = GetOrCreateTest(sTestName);
-  assert(pResult != nullptr);
-  pResult->SetFailed();
+  environment[spitfire::string::ToUTF8(sName)] = spitfire::string::ToUTF8(sValue);
 }
 
-void cReportProject::SetTestResultNotRun(const string_t& sTarget, const string_t& sTestName)
+void cChildProcess::AddInheritedFileDescriptor(int fd)
 {
-  cReportTarget* pTarget = GetOrCreateTarget(sTarget);
-  assert(pTarget != nullptr);
-  pTarget->SetTestResultNotRun(sTestName);
+  inheritedFileDescriptors.push_back(fd);
 }
 
-void cReportProject::SetTestResultPassed(const string_t& sTarget, const string_t& sTestName)
+void cChildProcess::SetLogFile(const string_t& _sLogFilePath, bool bAppend)
 {
-  cReportTarget* pTarget = GetOrCreateTarget(sTarget);
-  assert(pTarget != nullptr);
-  pTarget->SetTestResultPassed(sTestName);
+  sLogFilePath = _sLogFilePath;
+  bAppendToLogFile = bAppend;
 }
 
-void cReportProject::SetTestResultFailed(const string_t& sTarget, const string_t& sTestName)
+void cChildProcess::SetTimeoutMS(uint64_t _timeoutMS)
 {
-  cReportTarget* pTarget = GetOrCreateTarget(sTarget);
-  assert(pTarget != nullptr);
-  pTarget->SetTestResultFailed(sTestName);
+  timeoutMS = _timeoutMS;
+}
+
+void cChildProcess::SetCancelFlag(const std::atomic<bool>& bIsCancelled)
+{
+  pIsCancelled = &bIsCancelled;
 }
 
+string_t cChildProcess::GetCommandLine() const
+{
+  string_t sCommandLine;
+  const size_t n = arguments.size();
+  for (size_t i = 0; i < n; i++) {
+    if (i != 0) sCommandLine += TEXT(" ");
+    sCommandLine += arguments[i];
+  }
 
+  return sCommandLine;
+}
 
-class cReport
+int cChildProcess::Run(std::string& sOutput) const
 {
-public:
-  bool IsSuccess() const;
+  cResourceUsage usage;
+  return Run(sOutput, usage);
+}
 
-  const std::vector<cReportProject*>& GetProjects() const { return projects; }
-  void AddProject(const string_t& sProjectName);
+int cChildProcess::Run(std::string& sOutput, cResourceUsage& usage) const
+{
+  sOutput.clear();
+  usage = cResourceUsage();
+
+  if (arguments.empty()) return -1;
+  if ((pIsCancelled != nullptr) && *pIsCancelled) return iReturnCodeCancelled;
+
+  // Everything the child needs is created before we fork, only async-signal-safe functions may be called in the child of a threaded process
+  const std::string sWorkingFolderUTF8 = spitfire::string::ToUTF8(sWorkingFolder);
+
+  std::vector<std::string> argumentsUTF8;
+  for (size_t i = 0; i < arguments.size(); i++) argumentsUTF8.push_back(spitfire::string::ToUTF8(arguments[i]));
+  std::vector<char*> argv;
+  for (size_t i = 0; i < argumentsUTF8.size(); i++) argv.push_back(const_cast<char*>(argumentsUTF8[i].c_str()));
+  argv.push_back(nullptr);
+
+  std::vector<std::string> environmentUTF8;
+  for (char** pVariable = environ; *pVariable != nullptr; pVariable++) {
+    const std::string sVariable(*pVariable);
+    const std::string sName = sVariable.substr(0, sVariable.find('='));
+    if (environment.find(sName) == environment.end()) environmentUTF8.push_back(sVariable);
+  }
+  for (std::map<std::string, std::string>::const_iterator iter = environment.begin(); iter != environment.end(); iter++) {
+    environmentUTF8.push_back(iter->first + "=" + iter->second);
+  }
+  std::vector<char*> envp;
+  for (size_t i = 0; i < environmentUTF8.size(); i++) envp.push_back(const_cast<char*>(environmentUTF8[i].c_str()));
+  envp.push_back(nullptr);
+
+  int fdLog = -1;
+  if (!sLogFilePath.empty()) {
+    fdLog = open(spitfire::string::ToUTF8(sLogFilePath).c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (bAppendToLogFile ? O_APPEND : O_TRUNC), 0644);
+    if (fdLog < 0) LOGERROR<<TEXT("cChildProcess::Run Failed to open log file \"")<<sLogFilePath<<TEXT("\", errno=")<<errno<<std::endl;
+  }
 
-  void AddTest(const string_t& sProjectName, const string_t& sTestName);
-  void SetTestResultNotRun(const string_t& sProjectName, const string_t& sTestName);
-  void SetTestResultPassed(const string_t& sProjectName, const string_t& sTestName);
-  void SetTestResultFailed(const string_t& sProjectName, const string_t& sTestName);
+  // Close on exec so that children started at the same time from other threads don't hold on to our end of the pipe
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) != 0) {
+    if (fdLog >= 0) close(fdLog);
+    return -1;
+  }
 
-  void AddTest(const string_t& sProjectName, const string_t& sTargetName, const string_t& sTestName);
-  void SetTestResultNotRun(const string_t& sProjectName, const string_t& sTargetName, const string_t& sTestName);
-  void SetTestResultPassed(const string_t& sProjectName, const string_t& sTargetName, const string_t& sTestName);
-  void SetTestResultFailed(const string_t& sProjectName, const string_t& sTargetName, const string_t& sTestName);
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
-private:
-  cReportProject* GetOrCreateProject(const string_t& sProjectName);
+  const pid_t pid = fork();
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    if (fdLog >= 0) close(fdLog);
+    return -1;
+  }
 
-  std::vector<cReportProject*> projects;
-};
+  if (pid == 0) {
+    // Child
+    if ((timeoutMS != 0) || (pIsCancelled != nullptr)) setpgid(0, 0);
+    const int fdNull = open("/dev/null", O_RDONLY);
+    if (fdNull >= 0) dup2(fdNull, STDIN_FILENO);
+    dup2(fds[1], STDOUT_FILENO);
+    dup2(fds[1], STDERR_FILENO);
+    for (size_t i = 0; i < inheritedFileDescriptors.size(); i++) {
+      const int fd = inheritedFileDescriptors[i];
+      fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) & ~FD_CLOEXEC);
+    }
+    if (!sWorkingFolderUTF8.empty() && (chdir(sWorkingFolderUTF8.c_str()) != 0)) _exit(127);
+    execvpe(argv[0], &argv[0], &envp[0]);
+    _exit(127);
+  }
 
-cReportProject* cReport::GetOrCreateProject(const string_t& sProjectName)
-{
-  cReportProject* pProject = nullptr;
+  // Parent
+  close(fds[1]);
+
+  // Set the process group from both sides so that it exists before we could kill it, whichever of us runs first
+  const bool bIsKillable = ((timeoutMS != 0) || (pIsCancelled != nullptr));
+  if (bIsKillable) setpgid(pid, pid);
+
+  cOutputTail tail(nOutputTailBytes);
+
+  uint64_t deadlineMS = (timeoutMS != 0) ? timeoutMS : UINT64_MAX;
+  bool bIsKilled = false;
+  bool bIsTimedOut = false;
+  bool bIsCancelled = false;
+
+  char buffer[4096];
+  while (true) {
+    if (bIsKillable) {
+      const uint64_t elapsedMS = GetElapsedMS(start);
+      if (bIsKilled && (elapsedMS >= deadlineMS)) {
+        // Something outside of the process group is still holding the pipe open, give up on the rest of the output
+        break;
+      } else if (!bIsKilled && ((elapsedMS >= deadlineMS) || ((pIsCancelled != nullptr) && *pIsCancelled))) {
+        bIsTimedOut = (elapsedMS >= deadlineMS);
+        bIsCancelled = !bIsTimedOut;
+
+        // Kill the whole process group so that nothing the child started is left running
+        if (bIsTimedOut) LOGERROR<<TEXT("cChildProcess::Run \"")<<GetCommandLine()<<TEXT("\" timed out after ")<<elapsedMS<<TEXT(" ms, killing it")<<std::endl;
+        else LOG<<TEXT("cChildProcess::Run \"")<<GetCommandLine()<<TEXT("\" was cancelled, killing it")<<std::endl;
+        kill(-pid, SIGKILL);
+        bIsKilled = true;
+        deadlineMS = elapsedMS + killedOutputTimeoutMS;
+      }
 
-  const size_t n = projects.size();
-  for (size_t i = 0; i < n; i++) {
-    if (projects[i]->GetName() == sProjectName) {
-      pProject = projects[i];
-      break;
+      uint64_t waitMS = deadlineMS - elapsedMS;
+      if (!bIsKilled && (pIsCancelled != nullptr) && (waitMS > cancelPollIntervalMS)) waitMS = cancelPollIntervalMS;
+
+      struct pollfd fd;
+      fd.fd = fds[0];
+      fd.events = POLLIN;
+      fd.revents = 0;
+      const int iResult = poll(&fd, 1, int(waitMS));
+      if ((iResult == 0) || ((iResult < 0) && (errno == EINTR))) continue;
+      else if (iResult < 0) break;
     }
+
+    const ssize_t nRead = read(fds[0], buffer, sizeof(buffer));
+    if (nRead > 0) {
+      tail.Append(buffer, nRead);
+      if ((fdLog >= 0) && (write(fdLog, buffer, nRead) != nRead)) {
+        LOGERROR<<TEXT("cChildProcess::Run Failed to write to log file \"")<<sLogFilePath<<TEXT("\", errno=")<<errno<<std::endl;
+        close(fdLog);
+        fdLog = -1;
+      }
+    } else if ((nRead < 0) && (errno == EINTR)) continue;
+    else break;
   }
+  close(fds[0]);
+  if (fdLog >= 0) close(fdLog);
 
-  // If we still haven't found the project then we need to create one
-  if (pProject == nullptr) {
-    pProject = new cReportProject(sProjectName);
-    projects.push_back(pProject);
+  sOutput = tail.GetString();
+
+  // Reap the child with wait4 so that we also get the resources that it and its descendants used
+  int status = 0;
+  struct rusage resources;
+  memset(&resources, 0, sizeof(resources));
+  while (wait4(pid, &status, 0, &resources) < 0) {
+    if (errno != EINTR) return -1;
   }
 
-  assert(pProject != nullptr);
-  return pProject;
+  usage.wallMS = GetElapsedMS(start);
+  usage.userMS = (uint64_t(resources.ru_utime.tv_sec) * 1000) + (uint64_t(resources.ru_utime.tv_usec) / 1000);
+  usage.systemMS = (uint64_t(resources.ru_stime.tv_sec) * 1000) + (uint64_t(resources.ru_stime.tv_usec) / 1000);
+  usage.peakRSSKB = uint64_t(resources.ru_maxrss); // Linux reports this in kilobytes
+
+  if (bIsTimedOut) return iReturnCodeTimedOut;
+  if (bIsCancelled) return iReturnCodeCancelled;
+  if (WIFEXITED(status)) return WEXITSTATUS(status);
+  if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+  return -1;
 }
 
-void cReport::AddProject(const string_t& sProjectName)
+
+// A GNU make jobserver that every make we start shares, so that no matter how many targets are building at once there are at most
+// nTokens compile jobs running in total
+// Each make gets one implicit job for free, so we take a token on its behalf before starting it and give it back when it exits
+// The tokens live in a named fifo, make is given the file descriptors of it the way make 4.3 and earlier expect, ninja 1.13 and later only
+// understand the path of the fifo, both read and write the same fifo so they share one pool of tokens
+class cJobServer
+{
+public:
+  cJobServer();
+  ~cJobServer();
+
+  bool Create(size_t nTokens);
+  void Destroy();
+
+  bool IsValid() const { return (fdRead != -1); }
+  bool IsFifo() const { return !sFifoFilePath.empty(); }
+  size_t GetTokens() const { return nTokens; }
+
+  void AcquireToken();
+  void ReleaseToken();
+  void AcquireTokens(size_t n);
+  void ReleaseTokens(size_t n);
+
+  void AddToChildProcess(cChildProcess& process) const;
+  void AddFifoToChildProcess(cChildProcess& process) const;
+
+private:
+  int fdRead;
+  int fdWrite;
+  size_t nTokens;
+  string_t sFifoFolder;
+  string_t sFifoFilePath;
+  std::mutex mutexAcquireTokens;
+};
+
+cJobServer::cJobServer() :
+  fdRead(-1),
+  fdWrite(-1),
+  nTokens(0)
 {
-  GetOrCreateProject(sProjectName);
 }
 
-void cReport::AddTest(const string_t& sProjectName, const string_t& sTestName)
+cJobServer::~cJobServer()
 {
-  SetTestResultNotRun(sProjectName, sTestName);
+  Destroy();
 }
 
-void cReport::SetTestResultNotRun(const string_t& sProjectName, const string_t& sTestName)
+bool cJobServer::Create(size_t _nTokens)
 {
-  cReportProject* pProject = GetOrCreateProject(sProjectName);
+  Destroy();
+
+  // Fall back to an anonymous pipe if we can't make a fifo, make can still share it but ninja can't
+  char szFolder[] = "/tmp/buildall-jobserver-XXXXXX";
+  if (mkdtemp(szFolder) != nullptr) {
+    const std::string sFifo = std::string(szFolder) + "/fifo";
+    if (mkfifo(sFifo.c_str(), 0600) == 0) {
+      // Opening the fifo for reading and writing doesn't wait for another process to open the other end
+      fdRead = open(sFifo.c_str(), O_RDWR | O_CLOEXEC);
+      fdWrite = (fdRead != -1) ? open(sFifo.c_str(), O_WRONLY | O_CLOEXEC) : -1;
+      sFifoFilePath = spitfire::string::ToString_t(sFifo);
+    }
+    sFifoFolder = spitfire::string::ToString_t(szFolder);
+  }
 
-  ASSERT(pProject != nullptr);
-  pProject->SetTestResultNotRun(sTestName);
+  if ((fdRead == -1) || (fdWrite == -1)) {
+    if (!sFifoFolder.empty()) LOGERROR<<TEXT("cJobServer::Create Failed to create a fifo in \"")<<sFifoFolder<<TEXT("\", errno=")<<errno<<TEXT(", ninja will not share the jobserver")<<std::endl;
+    Destroy();
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+      LOGERROR<<TEXT("cJobServer::Create pipe2 failed, errno=")<<errno<<std::endl;
+      return false;
+    }
+
+    fdRead = fds[0];
+    fdWrite = fds[1];
+  }
+
+  nTokens = std::max<size_t>(1, _nTokens);
+
+  for (size_t i = 0; i < nTokens; i++) ReleaseToken();
+
+  return true;
 }
 
-void cReport::SetTestResultPassed(const string_t& sProjectName, const string_t& sTestName)
+void cJobServer::Destroy()
 {
-  cReportProject* pProject = GetOrCreateProject(sProjectName);
-
-  ASSERT(pProject != nullptr);
-  pProject->SetTestResultPassed(sTestName);
+  if (fdRead != -1) close(fdRead);
+  if (fdWrite != -1) close(fdWrite);
+  fdRead = -1;
+  fdWrite = -1;
+  nTokens = 0;
+
+  if (!sFifoFilePath.empty()) unlink(spitfire::string::ToUTF8(sFifoFilePath).c_str());
+  if (!sFifoFolder.empty()) rmdir(spitfire::string::ToUTF8(sFifoFolder).c_str());
+  sFifoFilePath.clear();
+  sFifoFolder.clear();
 }
 
-void cReport::SetTestResultFailed(const string_t& sProjectName, const string_t& sTestName)
+void cJobServer::AcquireToken()
 {
-  cReportProject* pProject = GetOrCreateProject(sProjectName);
+  char token = 0;
+  while ((read(fdRead, &token, 1) < 0) && (errno == EINTR));
+}
 
-  ASSERT(pProject != nullptr);
-  pProject->SetTestResultFailed(sTestName);
+void cJobServer::ReleaseToken()
+{
+  const char token = '+';
+  while ((write(fdWrite, &token, 1) < 0) && (errno == EINTR));
 }
 
-void cReport::AddTest(const string_t& sProjectName, const string_t& sTargetName, const string_t& sTestName)
+// Only one caller collects several tokens at a time, otherwise two callers each holding part of what they need could wait on each other forever
+void cJobServer::AcquireTokens(size_t n)
 {
-  SetTestResultNotRun(sProjectName, sTargetName, sTestName);
+  std::lock_guard<std::mutex> lock(mutexAcquireTokens);
+  for (size_t i = 0; i < n; i++) AcquireToken();
 }
 
-void cReport::SetTestResultNotRun(const string_t& sProjectName, const string_t& sTargetName, const string_t& sTestName)
+void cJobServer::ReleaseTokens(size_t n)
 {
-  cReportProject* pProject = GetOrCreateProject(sProjectName);
-  assert(pProject != nullptr);
-  pProject->SetTestResultNotRun(sTargetName, sTestName);
+  for (size_t i = 0; i < n; i++) ReleaseToken();
 }
 
-void cReport::SetTestResultPassed(const string_t& sProjectName, const string_t& sTargetName, const string_t& sTestName)
+void cJobServer::AddToChildProcess(cChildProcess& process) const
 {
-  cReportProject* pProject = GetOrCreateProject(sProjectName);
-  assert(pProject != nullptr);
-  pProject->SetTestResultPassed(sTargetName, sTestName);
+  // The same flags that a top level make passes to its sub makes
+  ostringstream_t o;
+  o<<TEXT("-j")<<nTokens<<TEXT(" --jobserver-auth=")<<fdRead<<TEXT(",")<<fdWrite;
+  process.SetEnvironmentVariable(TEXT("MAKEFLAGS"), o.str());
+  process.AddInheritedFileDescriptor(fdRead);
+  process.AddInheritedFileDescriptor(fdWrite);
 }
 
-void cReport::SetTestResultFailed(const string_t& sProjectName, const string_t& sTargetName, const string_t& sTestName)
+void cJobServer::AddFifoToChildProcess(cChildProcess& process) const
 {
-  cReportProject* pProject = GetOrCreateProject(sProjectName);
-  assert(pProject != nullptr);
-  pProject->SetTestResultFailed(sTargetName, sTestName);
+  // ninja 1.13 and later only take their jobs from a jobserver that is passed by path
+  ostringstream_t o;
+  o<<TEXT("-j")<<nTokens<<TEXT(" --jobserver-auth=fifo:")<<sFifoFilePath;
+  process.SetEnvironmentVariable(TEXT("MAKEFLAGS"), o.str());
 }
 
 
-class cTarget
+// Decides when the next build step may start, so that several big steps (Two C++ links for example) don't all start at once and push the
+// machine into swap, we share the machine with other jobs so we look at how loaded it actually is rather than trusting a fixed number of jobs
+// A step may start if the memory and cores it says it needs fit in what is left after the steps already running have taken what they said
+// they need, and the machine isn't under memory or cpu pressure (Linux PSI), otherwise it waits for a step to finish or the pressure to drop
+// NOTE: Memory that a running step has already allocated is also missing from MemAvailable so we err on the side of starting fewer steps
+// NOTE: A step can always start if nothing else is running so that a step that needs more than the machine has still runs on its own
+class cAdmissionControl
 {
 public:
-  string_t sName;
-  string_t sApplication;
-  string_t sFolder;
-};
+  cAdmissionControl();
 
-class cProject
-{
-public:
-  static bool DependenciesCompare(const cProject& lhs, const cProject& rhs);
+  void SetCores(size_t nCores);
+  void SetPressureThresholds(size_t nMemoryPressurePercent, size_t nCPUPressurePercent);
 
-  bool IsProtocolGit() const;
-  bool IsProtocolSvn() const;
+  void Acquire(const string_t& sStep, uint64_t memoryKB, size_t cores);
+  void Release(uint64_t memoryKB, size_t cores);
 
-  string_t sName;
-  string_t sURL;
-  string_t sFolderName;
+private:
+  static const uint64_t minimumAvailableMemoryKB = 512 * 1024; // Never start a step that would leave less than this available
 
-  std::vector<string_t> dependenciesAsString;
-  void BuildDepencenciesGraph(std::vector<cProject>& allProjects); // Fill out dependencies from dependenciesAsString
+  bool CanStart(uint64_t memoryKB, size_t cores, string_t& sReason) const;
 
-  std::vector<cTarget> targets;
+  static bool ReadAvailableMemoryKB(uint64_t& availableKB);
+  static bool ReadPressurePercent(const char* szFilePath, double& percent);
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  size_t nRunning;
+  uint64_t reservedMemoryKB;
+  size_t reservedCores;
+
+  size_t nCores;
+  size_t nMemoryPressurePercent; // The share of the last 10 seconds that some tasks were stalled waiting on memory
+  size_t nCPUPressurePercent; // The share of the last 10 seconds that some runnable tasks were waiting for a cpu
+};
+
+cAdmissionControl::cAdmissionControl() :
+  nRunning(0),
+  reservedMemoryKB(0),
+  reservedCores(0),
+  nCores(std::max<size_t>(1, std::thread::hardware_concurrency())),
+  nMemoryPressurePercent(10),
+  nCPUPressurePercent(80)
+{
+}
+
+void cAdmissionControl::SetCores(size_t _nCores)
+{
+  nCores = std::max<size_t>(1, _nCores);
+}
+
+void cAdmissionControl::SetPressureThresholds(size_t _nMemoryPressurePercent, size_t _nCPUPressurePercent)
+{
+  nMemoryPressurePercent = _nMemoryPressurePercent;
+  nCPUPressurePercent = _nCPUPressurePercent;
+}
+
+// Reads MemAvailable from /proc/meminfo
+bool cAdmissionControl::ReadAvailableMemoryKB(uint64_t& availableKB)
+{
+  std::ifstream file("/proc/meminfo");
+  std::string sName;
+  uint64_t value = 0;
+  std::string sUnit;
+  while (file>>sName>>value>>sUnit) {
+    if (sName == "MemAvailable:") {
+      availableKB = value;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Reads avg10 from the "some" line of a /proc/pressure file, for example "some avg10=1.52 avg60=0.80 avg300=0.21 total=12345"
+// NOTE: Returns false if the kernel doesn't support PSI
+bool cAdmissionControl::ReadPressurePercent(const char* szFilePath, double& percent)
+{
+  std::ifstream file(szFilePath);
+  std::string sLine;
+  while (std::getline(file, sLine)) {
+    if (sLine.compare(0, 5, "some ") != 0) continue;
+
+    const size_t position = sLine.find("avg10=");
+    if (position == std::string::npos) return false;
+
+    percent = atof(sLine.c_str() + position + 6);
+    return true;
+  }
+
+  return false;
+}
+
+// NOTE: Only called with mutex locked
+bool cAdmissionControl::CanStart(uint64_t memoryKB, size_t cores, string_t& sReason) const
+{
+  if (nRunning == 0) return true;
+
+  if ((reservedCores + cores) > nCores) {
+    sReason = TEXT("cores");
+    return false;
+  }
+
+  uint64_t availableKB = 0;
+  if (ReadAvailableMemoryKB(availableKB) && ((reservedMemoryKB + memoryKB + minimumAvailableMemoryKB) > availableKB)) {
+    sReason = TEXT("memory");
+    return false;
+  }
+
+  double percent = 0.0;
+  if (ReadPressurePercent("/proc/pressure/memory", percent) && (percent > double(nMemoryPressurePercent))) {
+    sReason = TEXT("memory pressure");
+    return false;
+  }
+
+  if (ReadPressurePercent("/proc/pressure/cpu", percent) && (percent > double(nCPUPressurePercent))) {
+    sReason = TEXT("cpu pressure");
+    return false;
+  }
+
+  return true;
+}
+
+void cAdmissionControl::Acquire(const string_t& sStep, uint64_t memoryKB, size_t cores)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+
+  // Pressure and available memory change without any of our steps finishing so check again every second
+  string_t sReason;
+  bool bIsWaiting = false;
+  while (!CanStart(memoryKB, cores, sReason)) {
+    if (!bIsWaiting) LOG<<TEXT("cAdmissionControl::Acquire \"")<<sStep<<TEXT("\" is waiting for ")<<sReason<<std::endl;
+    bIsWaiting = true;
+    condition.wait_for(lock, std::chrono::seconds(1));
+  }
+
+  nRunning++;
+  reservedMemoryKB += memoryKB;
+  reservedCores += cores;
+}
+
+void cAdmissionControl::Release(uint64_t memoryKB, size_t cores)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  assert(nRunning != 0);
+  nRunning--;
+  reservedMemoryKB -= std::min(reservedMemoryKB, memoryKB);
+  reservedCores -= std::min(reservedCores, cores);
+
+  condition.notify_all();
+}
+
+
+class cReportResult
+{
+public:
+  cReportResult();
+
+  const string_t& GetName() const { return sName; }
+  void SetName(const string_t& _sName) { sName = _sName; }
+
+  bool IsNotRun() const { return (state == STATE::NOT_RUN); }
+  bool IsPassed() const { return (state == STATE::PASSED); }
+  bool IsFailed() const { return (state == STATE::FAILED); }
+  bool IsCachedPassed() const { return (state == STATE::CACHED_PASSED); }
+  bool IsSkipped() const { return (state == STATE::SKIPPED); }
+
+  void SetNotRun() { state = STATE::NOT_RUN; }
+  void SetPassed() { state = STATE::PASSED; }
+  void SetFailed() { state = STATE::FAILED; }
+  void SetCachedPassed() { state = STATE::CACHED_PASSED; } // Passed on a previous run and nothing it depends on has changed since
+  void SetSkipped() { state = STATE::SKIPPED; } // Not run because a project it depends on failed
+
+  const cResourceUsage& GetResourceUsage() const { return usage; }
+  void SetResourceUsage(const cResourceUsage& _usage) { usage = _usage; }
+
+private:
+  string_t sName;
+  enum class STATE {
+    NOT_RUN,
+    PASSED,
+    FAILED,
+    CACHED_PASSED,
+    SKIPPED
+  };
+  STATE state;
+  cResourceUsage usage;
+};
+
+cReportResult::cReportResult() :
+  state(STATE::NOT_RUN)
+{
+}
+
+
+class cReportArena;
+
+
+class cReportTarget
+{
+public:
+  cReportTarget(cReportArena& arena, const string_t& sName);
+
+  bool IsSuccess() const;
+
+  const string_t& GetName() const { return sName; }
+  const std::vector<cReportResult*>& GetResults() const { return results; }
+
+  void SetTestResultNotRun(const string_t& sTestName);
+  void SetTestResultPassed(const string_t& sTestName);
+  void SetTestResultFailed(const string_t& sTestName);
+  void SetTestResultCachedPassed(const string_t& sTestName);
+  void SetTestResultSkipped(const string_t& sTestName);
+  void SetTestResourceUsage(const string_t& sTestName, const cResourceUsage& usage);
+
+private:
+  cReportResult* GetOrCreateTest(const string_t& sTestName);
+
+  cReportArena& arena;
+  string_t sName;
+  std::vector<cReportResult*> results; // In the order they were added
+  std::unordered_map<string_t, cReportResult*> resultsIndex;
+};
+
+cReportTarget::cReportTarget(cReportArena& _arena, const string_t& _sName) :
+  arena(_arena),
+  sName(_sName)
+{
+}
+
+void cReportTarget::SetTestResultNotRun(const string_t& sTestName)
+{
+  cReportResult* pResult = GetOrCreateTest(sTestName);
+  assert(pResult != nullptr);
+  pResult->SetNotRun();
+}
+
+void cReportTarget::SetTestResultPassed(const string_t& sTestName)
+{
+  cReportResult* pResult = GetOrCreateTest(sTestName);
+  assert(pResult != nullptr);
+  pResult->SetPassed();
+}
+
+void cReportTarget::SetTestResultFailed(const string_t& sTestName)
+{
+  cReportResult* pResult = GetOrCreateTest(sTestName);
+  assert(pResult != nullptr);
+  pResult->SetFailed();
+}
+
+void cReportTarget::SetTestResultCachedPassed(const string_t& sTestName)
+{
+  cReportResult* pResult = GetOrCreateTest(sTestName);
+  assert(pResult != nullptr);
+  pResult->SetCachedPassed();
+}
+
+void cReportTarget::SetTestResultSkipped(const string_t& sTestName)
+{
+  cReportResult* pResult = GetOrCreateTest(sTestName);
+  assert(pResult != nullptr);
+  pResult->SetSkipped();
+}
+
+
+void cReportTarget::SetTestResourceUsage(const string_t& sTestName, const cResourceUsage& usage)
+{
+  cReportResult* pResult = GetOrCreateTest(sTestName);
+  assert(pResult != nullptr);
+  pResult->SetResourceUsage(usage);
+}
+
+
+class cReportProject
+{
+public:
+  cReportProject(cReportArena& arena, const string_t& sName);
+
+  bool IsSuccess() const;
+
+  // Project
+  const string_t& GetName() const { return sName; }
+  const std::vector<cReportResult*>& GetResults() const { return results; }
+  void SetTestResultNotRun(const string_t& sTestName);
+  void SetTestResultPassed(const string_t& sTestName);
+  void SetTestResultFailed(const string_t& sTestName);
+  void SetTestResultCachedPassed(const string_t& sTestName);
+  void SetTestResourceUsage(const string_t& sTestName, const cResourceUsage& usage);
+
+  // Target
+  const std::vector<cReportTarget*>& GetTargets() const { return targets; }
+  void SetTestResultNotRun(const string_t& sTarget, const string_t& sTestName);
+  void SetTestResultPassed(const string_t& sTarget, const string_t& sTestName);
+  void SetTestResultFailed(const string_t& sTarget, const string_t& sTestName);
+  void SetTestResultCachedPassed(const string_t& sTarget, const string_t& sTestName);
+  void SetTestResultSkipped(const string_t& sTarget, const string_t& sTestName);
+  void SetTestResourceUsage(const string_t& sTarget, const string_t& sTestName, const cResourceUsage& usage);
+
+  // Critical path analysis
+  bool IsOnCriticalPath() const { return bIsOnCriticalPath; }
+  uint64_t GetSlackMS() const { return slackMS; }
+  void SetCriticalPathAnalysis(bool bIsOnCriticalPath, uint64_t slackMS);
+
+private:
+  cReportResult* GetOrCreateTest(const string_t& sTestName);
+
+  cReportTarget* GetOrCreateTarget(const string_t& sName);
+
+  cReportArena& arena;
+  string_t sName;
+  std::vector<cReportResult*> results; // In the order they were added
+  std::unordered_map<string_t, cReportResult*> resultsIndex;
+  std::vector<cReportTarget*> targets; // In the order they were added
+  std::unordered_map<string_t, cReportTarget*> targetsIndex;
+
+  bool bIsOnCriticalPath;
+  uint64_t slackMS; // How much later this project could have finished without delaying the whole run
+};
+
+
+// Owns every project, target and result of a report
+// Nodes are never moved or freed one at a time, so pointers to them stay valid until the arena is destroyed with the report
+class cReportArena
+{
+public:
+  cReportArena() {}
+
+  cReportResult* CreateResult(const string_t& sName);
+  cReportTarget* CreateTarget(const string_t& sName);
+  cReportProject* CreateProject(const string_t& sName);
 
 private:
-  bool IsDependentOn(const cProject& rhs) const;
+  cReportArena(const cReportArena&);
+  cReportArena& operator=(const cReportArena&);
+
+  std::deque<cReportResult> results;
+  std::deque<cReportTarget> targets;
+  std::deque<cReportProject> projects;
+};
+
+cReportResult* cReportArena::CreateResult(const string_t& sName)
+{
+  results.push_back(cReportResult());
+  cReportResult* pResult = &results.back();
+  pResult->SetName(sName);
+  pResult->SetNotRun();
+  return pResult;
+}
+
+cReportTarget* cReportArena::CreateTarget(const string_t& sName)
+{
+  targets.push_back(cReportTarget(*this, sName));
+  return &targets.back();
+}
+
+cReportProject* cReportArena::CreateProject(const string_t& sName)
+{
+  projects.push_back(cReportProject(*this, sName));
+  return &projects.back();
+}
+
+
+cReportResult* cReportTarget::GetOrCreateTest(const string_t& sTestName)
+{
+  // Find the test if it has already been added
+  std::unordered_map<string_t, cReportResult*>::const_iterator iter = resultsIndex.find(sTestName);
+  if (iter != resultsIndex.end()) return iter->second;
+
+  // We didn't find the test so we need to create a new one
+  cReportResult* pResult = arena.CreateResult(sTestName);
+  results.push_back(pResult);
+  resultsIndex[sTestName] = pResult;
+  return pResult;
+}
+
+
+cReportProject::cReportProject(cReportArena& _arena, const string_t& _sName) :
+  arena(_arena),
+  sName(_sName),
+  bIsOnCriticalPath(false),
+  slackMS(0)
+{
+}
+
+void cReportProject::SetCriticalPathAnalysis(bool _bIsOnCriticalPath, uint64_t _slackMS)
+{
+  bIsOnCriticalPath = _bIsOnCriticalPath;
+  slackMS = _slackMS;
+}
+
+cReportResult* cReportProject::GetOrCreateTest(const string_t& sTestName)
+{
+  // Find the test if it has already been added
+  std::unordered_map<string_t, cReportResult*>::const_iterator iter = resultsIndex.find(sTestName);
+  if (iter != resultsIndex.end()) return iter->second;
+
+  // We didn't find the test so we need to create a new one
+  cReportResult* pResult = arena.CreateResult(sTestName);
+  results.push_back(pResult);
+  resultsIndex[sTestName] = pResult;
+  return pResult;
+}
+
+cReportTarget* cReportProject::GetOrCreateTarget(const string_t& sName)
+{
+  // Find the target if it has already been added
+  std::unordered_map<string_t, cReportTarget*>::const_iterator iter = targetsIndex.find(sName);
+  if (iter != targetsIndex.end()) return iter->second;
+
+  // We didn't find the target so we need to create a new one
+  cReportTarget* pTarget = arena.CreateTarget(sName);
+  targets.push_back(pTarget);
+  targetsIndex[sName] = pTarget;
+  return pTarget;
+}
+
+void cReportProject::SetTestResultNotRun(const string_t& sTestName)
+{
+  cReportResult* pResult = GetOrCreateTest(sTestName);
+  assert(pResult != nullptr);
+  pResult->SetNotRun();
+}
+
+void cReportProject::SetTestResultPassed(const string_t& sTestName)
+{
+  cReportResult* pResult = GetOrCreateTest(sTestName);
+  assert(pResult != nullptr);
+  pResult->SetPassed();
+}
+
+void cReportProject::SetTestResultFailed(const string_t& sTestName)
+{
+  cReportResult* pResult = GetOrCreateTest(sTestName);
+  assert(pResult != nullptr);
+  pResult->SetFailed();
+}
+
+void cReportProject::SetTestResultCachedPassed(const string_t& sTestName)
+{
+  cReportResult* pResult = GetOrCreateTest(sTestName);
+  assert(pResult != nullptr);
+  pResult->SetCachedPassed();
+}
+
+void cReportProject::SetTestResourceUsage(const string_t& sTestName, const cResourceUsage& usage)
+{
+  cReportResult* pResult = GetOrCreateTest(sTestName);
+  assert(pResult != nullptr);
+  pResult->SetResourceUsage(usage);
+}
+
+void cReportProject::SetTestResultNotRun(const string_t& sTarget, const string_t& sTestName)
+{
+  cReportTarget* pTarget = GetOrCreateTarget(sTarget);
+  assert(pTarget != nullptr);
+  pTarget->SetTestResultNotRun(sTestName);
+}
+
+void cReportProject::SetTestResultPassed(const string_t& sTarget, const string_t& sTestName)
+{
+  cReportTarget* pTarget = GetOrCreateTarget(sTarget);
+  assert(pTarget != nullptr);
+  pTarget->SetTestResultPassed(sTestName);
+}
+
+void cReportProject::SetTestResultFailed(const string_t& sTarget, const string_t& sTestName)
+{
+  cReportTarget* pTarget = GetOrCreateTarget(sTarget);
+  assert(pTarget != nullptr);
+  pTarget->SetTestResultFailed(sTestName);
+}
+
+void cReportProject::SetTestResultCachedPassed(const string_t& sTarget, const string_t& sTestName)
+{
+  cReportTarget* pTarget = GetOrCreateTarget(sTarget);
+  assert(pTarget != nullptr);
+  pTarget->SetTestResultCachedPassed(sTestName);
+}
+
+void cReportProject::SetTestResultSkipped(const string_t& sTarget, const string_t& sTestName)
+{
+  cReportTarget* pTarget = GetOrCreateTarget(sTarget);
+  assert(pTarget != nullptr);
+  pTarget->SetTestResultSkipped(sTestName);
+}
+
+void cReportProject::SetTestResourceUsage(const string_t& sTarget, const string_t& sTestName, const cResourceUsage& usage)
+{
+  cReportTarget* pTarget = GetOrCreateTarget(sTarget);
+  assert(pTarget != nullptr);
+  pTarget->SetTestResourceUsage(sTestName, usage);
+}
+
+
+
+// One step on the critical path of a run
+class cCriticalPathStep
+{
+public:
+  string_t sProject;
+  string_t sTarget;
+  string_t sStep;
+  uint64_t durationMS;
+};
+
+// When a step of this run started and finished, in milliseconds since the run started
+class cStepTiming
+{
+public:
+  string_t sTarget; // Empty for the clone of a project
+  string_t sStep;
+  uint64_t startMS;
+  uint64_t finishMS;
+  bool bIsFinished;
+};
+
+class cReport
+{
+public:
+  cReport();
+
+  bool IsSuccess() const;
+
+  const std::vector<cReportProject*>& GetProjects() const { return projects; }
+  const cReportProject* GetProject(const string_t& sProjectName) const;
+  void AddProject(const string_t& sProjectName);
+
+  void AddTest(const string_t& sProjectName, const string_t& sTestName);
+  void SetTestResultNotRun(const string_t& sProjectName, const string_t& sTestName);
+  void SetTestResultPassed(const string_t& sProjectName, const string_t& sTestName);
+  void SetTestResultFailed(const string_t& sProjectName, const string_t& sTestName);
+  void SetTestResultCachedPassed(const string_t& sProjectName, const string_t& sTestName);
+  void SetTestResourceUsage(const string_t& sProjectName, const string_t& sTestName, const cResourceUsage& usage);
+
+  void AddTest(const string_t& sProjectName, const string_t& sTargetName, const string_t& sTestName);
+  void SetTestResultNotRun(const string_t& sProjectName, const string_t& sTargetName, const string_t& sTestName);
+  void SetTestResultPassed(const string_t& sProjectName, const string_t& sTargetName, const string_t& sTestName);
+  void SetTestResultFailed(const string_t& sProjectName, const string_t& sTargetName, const string_t& sTestName);
+  void SetTestResultCachedPassed(const string_t& sProjectName, const string_t& sTargetName, const string_t& sTestName);
+  void SetTestResultSkipped(const string_t& sProjectName, const string_t& sTargetName, const string_t& sTestName);
+  void SetTestResourceUsage(const string_t& sProjectName, const string_t& sTargetName, const string_t& sTestName, const cResourceUsage& usage);
+
+  // Critical path analysis
+  const std::vector<cCriticalPathStep>& GetCriticalPath() const { return criticalPath; }
+  uint64_t GetCriticalPathDurationMS() const { return criticalPathDurationMS; }
+  void SetCriticalPath(const std::vector<cCriticalPathStep>& criticalPath, uint64_t criticalPathDurationMS);
+  void SetCriticalPathAnalysis(const string_t& sProjectName, bool bIsOnCriticalPath, uint64_t slackMS);
+
+private:
+  cReportProject* GetOrCreateProject(const string_t& sProjectName);
+
+  mutable std::mutex mutex; // Projects and targets may report their results from several build threads at once
+  cReportArena arena;
+  std::vector<cReportProject*> projects; // In the order they were added
+  std::unordered_map<string_t, cReportProject*> projectsIndex;
+
+  std::vector<cCriticalPathStep> criticalPath;
+  uint64_t criticalPathDurationMS;
+};
+
+cReport::cReport() :
+  criticalPathDurationMS(0)
+{
+}
+
+const cReportProject* cReport::GetProject(const string_t& sProjectName) const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  std::unordered_map<string_t, cReportProject*>::const_iterator iter = projectsIndex.find(sProjectName);
+  return (iter != projectsIndex.end()) ? iter->second : nullptr;
+}
+
+void cReport::SetCriticalPath(const std::vector<cCriticalPathStep>& _criticalPath, uint64_t _criticalPathDurationMS)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  criticalPath = _criticalPath;
+  criticalPathDurationMS = _criticalPathDurationMS;
+}
+
+void cReport::SetCriticalPathAnalysis(const string_t& sProjectName, bool bIsOnCriticalPath, uint64_t slackMS)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  cReportProject* pProject = GetOrCreateProject(sProjectName);
+  assert(pProject != nullptr);
+  pProject->SetCriticalPathAnalysis(bIsOnCriticalPath, slackMS);
+}
+
+cReportProject* cReport::GetOrCreateProject(const string_t& sProjectName)
+{
+  std::unordered_map<string_t, cReportProject*>::const_iterator iter = projectsIndex.find(sProjectName);
+  if (iter != projectsIndex.end()) return iter->second;
+
+  // We haven't seen this project yet so we need to create one
+  cReportProject* pProject = arena.CreateProject(sProjectName);
+  projects.push_back(pProject);
+  projectsIndex[sProjectName] = pProject;
+  return pProject;
+}
+
+void cReport::AddProject(const string_t& sProjectName)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  GetOrCreateProject(sProjectName);
+}
+
+void cReport::AddTest(const string_t& sProjectName, const string_t& sTestName)
+{
+  SetTestResultNotRun(sProjectName, sTestName);
+}
+
+void cReport::SetTestResultNotRun(const string_t& sProjectName, const string_t& sTestName)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  cReportProject* pProject = GetOrCreateProject(sProjectName);
+
+  ASSERT(pProject != nullptr);
+  pProject->SetTestResultNotRun(sTestName);
+}
+
+void cReport::SetTestResultPassed(const string_t& sProjectName, const string_t& sTestName)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  cReportProject* pProject = GetOrCreateProject(sProjectName);
+
+  ASSERT(pProject != nullptr);
+  pProject->SetTestResultPassed(sTestName);
+}
+
+void cReport::SetTestResultFailed(const string_t& sProjectName, const string_t& sTestName)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  cReportProject* pProject = GetOrCreateProject(sProjectName);
+
+  ASSERT(pProject != nullptr);
+  pProject->SetTestResultFailed(sTestName);
+}
+
+void cReport::SetTestResultCachedPassed(const string_t& sProjectName, const string_t& sTestName)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  cReportProject* pProject = GetOrCreateProject(sProjectName);
+
+  ASSERT(pProject != nullptr);
+  pProject->SetTestResultCachedPassed(sTestName);
+}
+
+void cReport::SetTestResourceUsage(const string_t& sProjectName, const string_t& sTestName, const cResourceUsage& usage)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  cReportProject* pProject = GetOrCreateProject(sProjectName);
+
+  ASSERT(pProject != nullptr);
+  pProject->SetTestResourceUsage(sTestName, usage);
+}
+
+void cReport::AddTest(const string_t& sProjectName, const string_t& sTargetName, const string_t& sTestName)
+{
+  SetTestResultNotRun(sProjectName, sTargetName, sTestName);
+}
+
+void cReport::SetTestResultNotRun(const string_t& sProjectName, const string_t& sTargetName, const string_t& sTestName)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  cReportProject* pProject = GetOrCreateProject(sProjectName);
+  assert(pProject != nullptr);
+  pProject->SetTestResultNotRun(sTargetName, sTestName);
+}
+
+void cReport::SetTestResultPassed(const string_t& sProjectName, const string_t& sTargetName, const string_t& sTestName)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  cReportProject* pProject = GetOrCreateProject(sProjectName);
+  assert(pProject != nullptr);
+  pProject->SetTestResultPassed(sTargetName, sTestName);
+}
+
+void cReport::SetTestResultFailed(const string_t& sProjectName, const string_t& sTargetName, const string_t& sTestName)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  cReportProject* pProject = GetOrCreateProject(sProjectName);
+  assert(pProject != nullptr);
+  pProject->SetTestResultFailed(sTargetName, sTestName);
+}
+
+void cReport::SetTestResultCachedPassed(const string_t& sProjectName, const string_t& sTargetName, const string_t& sTestName)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  cReportProject* pProject = GetOrCreateProject(sProjectName);
+  assert(pProject != nullptr);
+  pProject->SetTestResultCachedPassed(sTargetName, sTestName);
+}
+
+void cReport::SetTestResultSkipped(const string_t& sProjectName, const string_t& sTargetName, const string_t& sTestName)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  cReportProject* pProject = GetOrCreateProject(sProjectName);
+  assert(pProject != nullptr);
+  pProject->SetTestResultSkipped(sTargetName, sTestName);
+}
+
+void cReport::SetTestResourceUsage(const string_t& sProjectName, const string_t& sTargetName, const string_t& sTestName, const cResourceUsage& usage)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  cReportProject* pProject = GetOrCreateProject(sProjectName);
+  assert(pProject != nullptr);
+  pProject->SetTestResourceUsage(sTargetName, sTestName, usage);
+}
+
+
+// A streaming xml reader, each element is passed to the handler as soon as it has been read so the document is never held in memory
+// Only what our xml files need is supported, elements, attributes, comments, processing instructions, CDATA and the predefined and
+// numeric entities, text is skipped
+class cXMLStreamReader
+{
+public:
+  class cAttributes
+  {
+  public:
+    bool GetAttribute(const char* szName, string_t& sValue) const;
+
+    std::vector<std::pair<std::string, std::string> > values;
+  };
+
+  class cHandler
+  {
+  public:
+    virtual ~cHandler() {}
+
+    // Return false to stop reading
+    virtual bool OnStartElement(const std::string& sName, const cAttributes& attributes) = 0;
+    virtual bool OnEndElement(const std::string& sName) = 0;
+  };
+
+  cXMLStreamReader();
+  ~cXMLStreamReader();
+
+  // NOTE: Returns false with an empty error if the handler stopped reading
+  bool ReadFromFile(const string_t& sFilePath, cHandler& handler);
+
+  const string_t& GetError() const { return sError; }
+
+private:
+  int Get();
+  bool SkipPast(const char* szEnd);
+  void SkipSpaces(int& c);
+  bool ReadValue(int cQuote, std::string& sValue);
+  bool ReadEntity(std::string& sValue);
+  bool SetError(const char* szError);
+
+  FILE* pFile;
+  char buffer[64 * 1024];
+  size_t nBuffered;
+  size_t next;
+  size_t line;
+  string_t sFilePath;
+  string_t sError;
+};
+
+bool cXMLStreamReader::cAttributes::GetAttribute(const char* szName, string_t& sValue) const
+{
+  const size_t n = values.size();
+  for (size_t i = 0; i < n; i++) {
+    if (values[i].first == szName) {
+      sValue = spitfire::string::ToString_t(values[i].second);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+cXMLStreamReader::cXMLStreamReader() :
+  pFile(nullptr),
+  nBuffered(0),
+  next(0),
+  line(1)
+{
+}
+
+cXMLStreamReader::~cXMLStreamReader()
+{
+  if (pFile != nullptr) fclose(pFile);
+}
+
+int cXMLStreamReader::Get()
+{
+  if (next == nBuffered) {
+    nBuffered = fread(buffer, 1, sizeof(buffer), pFile);
+    next = 0;
+    if (nBuffered == 0) return EOF;
+  }
+
+  const int c = (unsigned char)buffer[next++];
+  if (c == '\n') line++;
+  return c;
+}
+
+bool cXMLStreamReader::SetError(const char* szError)
+{
+  ostringstream_t o;
+  o<<TEXT("\"")<<sFilePath<<TEXT("\" line ")<<line<<TEXT(": ")<<spitfire::string::ToString_t(szError);
+  sError = o.str();
+  return false;
+}
+
+// Matches szEnd the way Knuth-Morris-Pratt does, when a character doesn't continue the match we fall back to the longest prefix of szEnd that
+// is also a suffix of what we have matched so far, so "]]]>" still ends a CDATA section
+bool cXMLStreamReader::SkipPast(const char* szEnd)
+{
+  const size_t n = strlen(szEnd);
+
+  // fallback[i] is the length of the longest prefix of szEnd that is also a suffix of szEnd[1..i]
+  std::vector<size_t> fallback(n, 0);
+  for (size_t i = 1, k = 0; i < n; i++) {
+    while ((k != 0) && (szEnd[i] != szEnd[k])) k = fallback[k - 1];
+    if (szEnd[i] == szEnd[k]) k++;
+    fallback[i] = k;
+  }
+
+  size_t matched = 0;
+  while (matched != n) {
+    const int c = Get();
+    if (c == EOF) return SetError("Unexpected end of file");
+    while ((matched != 0) && (c != szEnd[matched])) matched = fallback[matched - 1];
+    if (c == szEnd[matched]) matched++;
+  }
+
+  return true;
+}
+
+void cXMLStreamReader::SkipSpaces(int& c)
+{
+  while ((c != EOF) && isspace(c)) c = Get();
+}
+
+// Reads the rest of an entity after the '&' and appends what it stands for
+bool cXMLStreamReader::ReadEntity(std::string& sValue)
+{
+  std::string sEntity;
+  for (int c = Get(); c != ';'; c = Get()) {
+    if ((c == EOF) || (sEntity.length() > 8)) return SetError("Invalid entity");
+    sEntity += char(c);
+  }
+
+  if (sEntity == "lt") sValue += '<';
+  else if (sEntity == "gt") sValue += '>';
+  else if (sEntity == "amp") sValue += '&';
+  else if (sEntity == "quot") sValue += '"';
+  else if (sEntity == "apos") sValue += '\'';
+  else if ((sEntity.length() > 1) && (sEntity[0] == '#')) {
+    const bool bIsHex = (sEntity[1] == 'x');
+    const unsigned long codePoint = strtoul(sEntity.c_str() + (bIsHex ? 2 : 1), nullptr, bIsHex ? 16 : 10);
+    if ((codePoint == 0) || (codePoint > 0x10FFFF)) return SetError("Invalid character reference");
+
+    // Encode as UTF8
+    if (codePoint < 0x80) sValue += char(codePoint);
+    else if (codePoint < 0x800) {
+      sValue += char(0xC0 | (codePoint >> 6));
+      sValue += char(0x80 | (codePoint & 0x3F));
+    } else if (codePoint < 0x10000) {
+      sValue += char(0xE0 | (codePoint >> 12));
+      sValue += char(0x80 | ((codePoint >> 6) & 0x3F));
+      sValue += char(0x80 | (codePoint & 0x3F));
+    } else {
+      sValue += char(0xF0 | (codePoint >> 18));
+      sValue += char(0x80 | ((codePoint >> 12) & 0x3F));
+      sValue += char(0x80 | ((codePoint >> 6) & 0x3F));
+      sValue += char(0x80 | (codePoint & 0x3F));
+    }
+  } else return SetError("Unknown entity");
+
+  return true;
+}
+
+bool cXMLStreamReader::ReadValue(int cQuote, std::string& sValue)
+{
+  sValue.clear();
+  for (int c = Get(); c != cQuote; c = Get()) {
+    if ((c == EOF) || (c == '<')) return SetError("Unterminated attribute value");
+    if (c == '&') {
+      if (!ReadEntity(sValue)) return false;
+    } else sValue += char(c);
+  }
+
+  return true;
+}
+
+bool cXMLStreamReader::ReadFromFile(const string_t& _sFilePath, cHandler& handler)
+{
+  sFilePath = _sFilePath;
+  sError.clear();
+  nBuffered = 0;
+  next = 0;
+  line = 1;
+
+  if (pFile != nullptr) fclose(pFile);
+  pFile = fopen(spitfire::string::ToUTF8(sFilePath).c_str(), "rb");
+  if (pFile == nullptr) return SetError("Failed to open file");
+
+  auto IsNameCharacter = [](int c) { return ((c != EOF) && !isspace(c) && (c != '/') && (c != '>') && (c != '=') && (c != '<')); };
+
+  std::vector<std::string> open; // The elements that we are inside of
+  cAttributes attributes;
+  std::string sName;
+
+  while (true) {
+    int c = Get();
+    if (c == EOF) break;
+    if (c != '<') continue;
+
+    c = Get();
+    if (c == '?') {
+      if (!SkipPast("?>")) return false;
+    } else if (c == '!') {
+      c = Get();
+      if (c == '-') {
+        if ((Get() != '-') || !SkipPast("-->")) return SetError("Invalid comment");
+      } else if (c == '[') {
+        if (!SkipPast("]]>")) return false;
+      } else {
+        // A DOCTYPE, possibly with an internal subset in brackets
+        int depth = 0;
+        for (; (c != EOF) && ((c != '>') || (depth != 0)); c = Get()) {
+          if (c == '[') depth++;
+          else if (c == ']') depth--;
+        }
+        if (c == EOF) return SetError("Unexpected end of file");
+      }
+    } else if (c == '/') {
+      sName.clear();
+      for (c = Get(); IsNameCharacter(c); c = Get()) sName += char(c);
+      SkipSpaces(c);
+      if (c != '>') return SetError("Invalid end tag");
+      if (open.empty() || (open.back() != sName)) return SetError("End tag does not match the start tag");
+      open.pop_back();
+      if (!handler.OnEndElement(sName)) return false;
+    } else {
+      sName.clear();
+      for (; IsNameCharacter(c); c = Get()) sName += char(c);
+      if (sName.empty()) return SetError("Invalid start tag");
+
+      attributes.values.clear();
+      bool bIsEmpty = false;
+      while (true) {
+        SkipSpaces(c);
+        if (c == '>') break;
+        if (c == '/') {
+          if (Get() != '>') return SetError("Invalid start tag");
+          bIsEmpty = true;
+          break;
+        }
+
+        std::string sAttribute;
+        for (; IsNameCharacter(c); c = Get()) sAttribute += char(c);
+        SkipSpaces(c);
+        if (sAttribute.empty() || (c != '=')) return SetError("Invalid attribute");
+        c = Get();
+        SkipSpaces(c);
+        if ((c != '"') && (c != '\'')) return SetError("Attribute value is not quoted");
+
+        attributes.values.push_back(std::make_pair(sAttribute, std::string()));
+        if (!ReadValue(c, attributes.values.back().second)) return false;
+        c = Get();
+      }
+
+      if (!handler.OnStartElement(sName, attributes)) return false;
+      if (bIsEmpty) {
+        if (!handler.OnEndElement(sName)) return false;
+      } else open.push_back(sName);
+    }
+  }
+
+  if (!open.empty()) return SetError("Unexpected end of file");
+
+  return true;
+}
+
+
+class cTarget
+{
+public:
+  cTarget();
+
+  string_t sName;
+  string_t sApplication;
+  string_t sFolder;
+  string_t sGenerator; // "ninja" or "make", empty to use the build manager's generator
+
+  // Optional hints for admission control, how much memory and how many cores the target's build steps need at most
+  uint64_t memoryKB;
+  size_t cores;
+};
+
+cTarget::cTarget() :
+  memoryKB(0),
+  cores(1)
+{
+}
+
+// Parses a size such as "512M" or "4G" (Binary units, without a unit the value is in bytes)
+bool ParseMemorySizeKB(const string_t& sValue, uint64_t& sizeKB)
+{
+  const std::string sValueUTF8 = spitfire::string::ToUTF8(sValue);
+  char* szEnd = nullptr;
+  const double value = strtod(sValueUTF8.c_str(), &szEnd);
+  if ((szEnd == sValueUTF8.c_str()) || (value < 0.0)) return false;
+
+  const std::string sUnit(szEnd);
+  double multiplier = 1.0 / 1024.0;
+  if ((sUnit == "K") || (sUnit == "KB")) multiplier = 1.0;
+  else if ((sUnit == "M") || (sUnit == "MB")) multiplier = 1024.0;
+  else if ((sUnit == "G") || (sUnit == "GB")) multiplier = 1024.0 * 1024.0;
+  else if (!sUnit.empty()) return false;
+
+  sizeKB = uint64_t(value * multiplier);
+  return true;
+}
+
+class cProject
+{
+public:
+  bool IsProtocolGit() const;
+  bool IsProtocolSvn() const;
+
+  string_t sName;
+  string_t sURL;
+  string_t sFolderName;
+
+  std::vector<string_t> dependenciesAsString;
+
+  std::vector<cTarget> targets;
+};
+
+bool cProject::IsProtocolGit() const
+{
+  // git://, git@host:path or anything ending in .git (Including local file:///path/repository.git bare repositories)
+  const string_t sPossiblyGitProtocol = sURL.substr(0, 3);
+  const string_t sGitExtension = TEXT(".git");
+  const bool bIsGitExtension = (sURL.length() >= sGitExtension.length()) && (sURL.compare(sURL.length() - sGitExtension.length(), sGitExtension.length(), sGitExtension) == 0);
+  const bool bIsGit = (sPossiblyGitProtocol == TEXT("git")) || bIsGitExtension;
+  return bIsGit;
+}
+
+bool cProject::IsProtocolSvn() const
+{
+  return !IsProtocolGit();
+}
+
+// Quote and escape a value for writing to a json file
+std::string GetJSONString(const string_t& sValue)
+{
+  const std::string sUTF8 = spitfire::string::ToUTF8(sValue);
+
+  std::string s = "\"";
+  const size_t n = sUTF8.length();
+  for (size_t i = 0; i < n; i++) {
+    const unsigned char c = sUTF8[i];
+    if (c == '"') s += "\\\"";
+    else if (c == '\\') s += "\\\\";
+    else if (c == '\n') s += "\\n";
+    else if (c == '\t') s += "\\t";
+    else if (c < 0x20) {
+      char szEscaped[8];
+      snprintf(szEscaped, sizeof(szEscaped), "\\u%04x", unsigned(c));
+      s += szEscaped;
+    } else s += char(c);
+  }
+  s += "\"";
+
+  return s;
+}
+
+// Numbers are written as strings, the same as every other value in results.json
+std::string GetJSONString(uint64_t value)
+{
+  std::ostringstream o;
+  o<<"\""<<value<<"\"";
+  return o.str();
+}
+
+
+// The dependencies between projects, worked out once when build.xml is loaded
+// Projects are referred to by their index in the list of projects that the graph was created from
+class cDependencyGraph
+{
+public:
+  cDependencyGraph();
+
+  // Resolves the dependency names of each project, logging any that don't exist, and finds the topological order and the transitive closure
+  void Create(const std::vector<cProject>& projects);
+
+  size_t GetProjectCount() const { return dependencies.size(); }
+
+  const std::vector<size_t>& GetDependencies(size_t iProject) const { return dependencies[iProject]; }
+  const std::vector<size_t>& GetDependents(size_t iProject) const { return dependents[iProject]; }
+
+  // Whether iProject depends on iDependency directly or indirectly
+  bool IsDependentOn(size_t iProject, size_t iDependency) const;
+  void GetAllDependencies(size_t iProject, std::vector<size_t>& allDependencies) const; // Every project that iProject depends on directly or indirectly
+
+  // A project without dependencies is on level 0, every other project is one level above its highest dependency
+  size_t GetLevel(size_t iProject) const { return levels[iProject]; }
+
+  // Every project after all of its dependencies, level by level, in build.xml order within a level
+  const std::vector<size_t>& GetTopologicalOrder() const { return order; }
+
+  // The projects of one dependency cycle in order with the first repeated at the end, or empty if there are no cycles
+  // NOTE: Projects on or downstream of a cycle are not in the topological order and have no closure
+  const std::vector<size_t>& GetCycle() const { return cycle; }
+
+  void WriteDOT(std::ostream& o, const std::vector<cProject>& projects) const;
+
+private:
+  std::vector<std::vector<size_t> > dependencies;
+  std::vector<std::vector<size_t> > dependents;
+  std::vector<size_t> levels;
+  std::vector<size_t> order;
+  std::vector<size_t> cycle;
+
+  size_t nWordsPerProject;
+  std::vector<uint64_t> closure; // A row of bits for each project with bit j set if the project depends on project j, directly or indirectly
+};
+
+cDependencyGraph::cDependencyGraph() :
+  nWordsPerProject(0)
+{
+}
+
+void cDependencyGraph::Create(const std::vector<cProject>& projects)
+{
+  const size_t nProjects = projects.size();
+
+  dependencies.assign(nProjects, std::vector<size_t>());
+  dependents.assign(nProjects, std::vector<size_t>());
+  levels.assign(nProjects, 0);
+  order.clear();
+  cycle.clear();
+
+  std::unordered_map<string_t, size_t> indices;
+  for (size_t i = 0; i < nProjects; i++) indices[projects[i].sName] = i;
+
+  for (size_t i = 0; i < nProjects; i++) {
+    const std::vector<string_t>& names = projects[i].dependenciesAsString;
+    for (size_t j = 0; j < names.size(); j++) {
+      std::unordered_map<string_t, size_t>::const_iterator iter = indices.find(names[j]);
+      if (iter == indices.end()) {
+        LOGERROR<<TEXT("Dependency \"")<<names[j]<<TEXT("\" not found for project \"")<<projects[i].sName<<TEXT("\"")<<std::endl;
+        continue;
+      }
+
+      // Ignore a dependency that is listed twice
+      if (std::find(dependencies[i].begin(), dependencies[i].end(), iter->second) != dependencies[i].end()) continue;
+
+      dependencies[i].push_back(iter->second);
+      dependents[iter->second].push_back(i);
+    }
+  }
+
+  // Peel off one level at a time, anything left over is on a cycle or depends on one
+  std::vector<size_t> remaining(nProjects, 0);
+  std::vector<size_t> level;
+  for (size_t i = 0; i < nProjects; i++) {
+    remaining[i] = dependencies[i].size();
+    if (remaining[i] == 0) level.push_back(i);
+  }
+
+  for (size_t iLevel = 0; !level.empty(); iLevel++) {
+    std::vector<size_t> nextLevel;
+    for (size_t k = 0; k < level.size(); k++) {
+      const size_t i = level[k];
+      levels[i] = iLevel;
+      order.push_back(i);
+      for (size_t j = 0; j < dependents[i].size(); j++) {
+        if (--remaining[dependents[i][j]] == 0) nextLevel.push_back(dependents[i][j]);
+      }
+    }
+    std::sort(nextLevel.begin(), nextLevel.end());
+    level.swap(nextLevel);
+  }
+
+  if (order.size() != nProjects) {
+    // Walk backwards along dependencies that are also left over, starting anywhere that is left over we must come back around to a project we have already seen
+    size_t i = 0;
+    while (remaining[i] == 0) i++;
+
+    std::vector<size_t> position(nProjects, size_t(-1));
+    std::vector<size_t> path;
+    while (position[i] == size_t(-1)) {
+      position[i] = path.size();
+      path.push_back(i);
+      for (size_t j = 0; j < dependencies[i].size(); j++) {
+        if (remaining[dependencies[i][j]] != 0) {
+          i = dependencies[i][j];
+          break;
+        }
+      }
+    }
+
+    cycle.assign(path.begin() + position[i], path.end());
+    cycle.push_back(i);
+  }
+
+  // Dependencies come before dependents in the order so each row only has to combine the finished rows of the direct dependencies
+  nWordsPerProject = (nProjects + 63) / 64;
+  closure.assign(nProjects * nWordsPerProject, 0);
+  for (size_t k = 0; k < order.size(); k++) {
+    const size_t i = order[k];
+    uint64_t* pRow = &closure[i * nWordsPerProject];
+    for (size_t j = 0; j < dependencies[i].size(); j++) {
+      const size_t iDependency = dependencies[i][j];
+      const uint64_t* pDependencyRow = &closure[iDependency * nWordsPerProject];
+      for (size_t w = 0; w < nWordsPerProject; w++) pRow[w] |= pDependencyRow[w];
+      pRow[iDependency / 64] |= uint64_t(1) << (iDependency % 64);
+    }
+  }
+}
+
+bool cDependencyGraph::IsDependentOn(size_t iProject, size_t iDependency) const
+{
+  return ((closure[(iProject * nWordsPerProject) + (iDependency / 64)] >> (iDependency % 64)) & 1) != 0;
+}
+
+void cDependencyGraph::GetAllDependencies(size_t iProject, std::vector<size_t>& allDependencies) const
+{
+  allDependencies.clear();
+
+  const uint64_t* pRow = &closure[iProject * nWordsPerProject];
+  for (size_t w = 0; w < nWordsPerProject; w++) {
+    for (uint64_t bits = pRow[w]; bits != 0; bits &= bits - 1) allDependencies.push_back((w * 64) + size_t(__builtin_ctzll(bits)));
+  }
+}
+
+// Each level is drawn as a row with an arrow from each project up to each of its dependencies, projects on or after a cycle are drawn in red
+void cDependencyGraph::WriteDOT(std::ostream& o, const std::vector<cProject>& projects) const
+{
+  const size_t nProjects = projects.size();
+
+  std::vector<bool> isOrdered(nProjects, false);
+  for (size_t k = 0; k < order.size(); k++) isOrdered[order[k]] = true;
+
+  o<<"digraph buildall {"<<std::endl;
+  o<<"  rankdir=BT;"<<std::endl;
+  o<<"  node [shape=box];"<<std::endl;
+  for (size_t i = 0; i < nProjects; i++) {
+    o<<"  n"<<i<<" [label="<<GetJSONString(projects[i].sName);
+    if (!isOrdered[i]) o<<", color=red";
+    o<<"];"<<std::endl;
+  }
+
+  size_t iLevel = 0;
+  for (size_t k = 0; k < order.size(); iLevel++) {
+    o<<"  { rank=same;";
+    for (; (k < order.size()) && (levels[order[k]] == iLevel); k++) o<<" n"<<order[k]<<";";
+    o<<" }"<<std::endl;
+  }
+
+  for (size_t i = 0; i < nProjects; i++) {
+    for (size_t j = 0; j < dependencies[i].size(); j++) o<<"  n"<<i<<" -> n"<<dependencies[i][j]<<";"<<std::endl;
+  }
+  o<<"}"<<std::endl;
+}
+
+// Listens to the progress of a build
+// NOTE: Calls come from several build threads at once, so implementations must do their own locking
+class cBuildObserver
+{
+public:
+  virtual ~cBuildObserver() {}
+
+  // All of the project's dependencies have finished and its targets are waiting to be built
+  virtual void OnProjectReady(const string_t& sProject) {}
+
+  // The project will not be built because one of its dependencies failed, or is blocked itself
+  virtual void OnProjectBlocked(const string_t& sProject, const string_t& sDependency) {}
+
+  // sTarget is empty for project steps such as "clone"
+  virtual void OnStepStarted(const string_t& sProject, const string_t& sTarget, const string_t& sStep) {}
+  virtual void OnStepFinished(const string_t& sProject, const string_t& sTarget, const string_t& sStep, bool bPassed, const cResourceUsage& usage) {}
+
+  // Called once for each project that built, failed or was up to date, as soon as all of its targets are done
+  virtual void OnProjectFinished(const cReportProject& project) {}
+};
+
+
+class cBuildManager
+{
+public:
+  explicit cBuildManager(const string_t& sXMLFilePath);
+
+  bool IsError() const;
+  string_t GetError() const;
+
+  void SetJobs(size_t nJobs);
+  void SetCloneJobs(size_t nCloneJobs);
+  void SetCompileJobs(size_t nCompileJobs);
+  void SetTestJobs(size_t nTestJobs);
+  void SetTestTimeoutSeconds(size_t nTestTimeoutSeconds);
+  void SetFailFast(bool bFailFast);
+  void SetGenerator(const string_t& sGenerator); // "ninja", "make" or empty to use ninja if it is installed
+  void SetPressureThresholds(size_t nMemoryPressurePercent, size_t nCPUPressurePercent);
+  void SetWorkspaceFolder(const string_t& sWorkspaceFolder);
+  void SetMirrorFolder(const string_t& sMirrorFolder);
+  void SetCompilerCache(const string_t& sCompilerCacheFolder, const string_t& sCompilerCacheMaxSize);
+  void SetLogFolder(const string_t& sLogFolder);
+  void SetFingerprintsFilePath(const string_t& sFingerprintsFilePath);
+  void SetUseFingerprints(bool bUseFingerprints);
+  void SetVerbose(bool bVerbose);
+  void AddObserver(cBuildObserver* pObserver);
+
+  // Only the projects and targets whose names match one of the patterns (Shell wildcards such as "Test*") are loaded, optionally along
+  // with every project that they depend on and every project that depends on them
+  void SetSelection(const std::vector<string_t>& patterns, bool bWithDependencies, bool bWithDependents);
+
+  // Parses build.xml and checks that the tools for each project are installed, once, the projects are then kept for every following build
+  bool LoadProjects();
+  bool IsLoaded() const { return bIsLoaded; }
+
+  // Asks each project's remote for its current revision without cloning anything, several projects at a time
+  // NOTE: A revision is empty if the remote could not be reached
+  void GetRemoteRevisions(std::vector<string_t>& revisions) const;
+
+  void ListAllProjects(cReport& report);
+  void WriteGraph(const string_t& sFilePath);
+  void BuildAllProjects(cReport& report, const std::vector<string_t>& remoteRevisions); // remoteRevisions are from GetRemoteRevisions, or empty to ask the remotes
+
+private:
+  void SetError(const string_t& sErrorMessage);
+  void ClearError();
+
+  void NotifyStepStarted(const string_t& sProject, const string_t& sTarget, const string_t& sStep) const;
+  void NotifyStepFinished(const string_t& sProject, const string_t& sTarget, const string_t& sStep, bool bPassed, const cResourceUsage& usage) const;
+
+  string_t GetLogFilePath(const string_t& sProjectName, const string_t& sTargetName, const string_t& sStepName) const;
+  int RunCommands(const std::vector<cChildProcess>& commands, const string_t& sLogFilePath, string_t& sFailedCommand, std::string& sOutput, cResourceUsage& usage) const;
+
+  class cBuildXMLHandler;
+  friend class cBuildXMLHandler;
+
+  void LoadFromXMLFile();
+  bool LoadFromXMLFile(const string_t& sFilePath, std::vector<string_t>& includes);
+  void SelectProjects();
+  void CreateDependencyGraph();
+
+  // Targets
+  string_t GetTargetFolder(const cProject& project, const cTarget& target) const;
+  bool IsJavaTarget(const cProject& project, const cTarget& target) const;
+  bool IsNinjaTarget(const cTarget& target) const;
+  void ResetBuildTreeIfGeneratorChanged(const string_t& sTargetFolder, const string_t& sGenerator) const;
+  std::vector<string_t> GetStepNames(const cProject& project, const cTarget& target) const;
+  bool BuildJava(cReport& report, const cProject& project, const cTarget& target);
+  bool BuildCPlusPlus(cReport& report, const cProject& project, const cTarget& target);
+  bool TestJava(cReport& report, const cProject& project, const cTarget& target);
+  bool TestCPlusPlus(cReport& report, const cProject& project, const cTarget& target);
+  bool Build(cReport& report, const cProject& project, const cTarget& target);
+  bool Test(cReport& report, const cProject& project, const cTarget& target);
+
+  // Projects
+  bool CheckPrerequisites(cReport& report, const cProject& project, std::map<string_t, bool>& installedTools);
+  bool Clone(cReport& report, const cProject& project);
+
+  string_t GetMirrorFolder(const string_t& sURL) const;
+  bool UpdateMirror(const string_t& sURL, const string_t& sMirrorFolder);
+  void UpdateMirrors(const std::vector<bool>& clone);
+  void PrepareCompilerCache();
+  void AddCompilerCacheToChildProcess(cChildProcess& process) const;
+  void CloneProjects(cReport& report, const std::vector<bool>& clone, std::vector<bool>& cloneFailed);
+  void GetProjectsToClone(const std::vector<bool>& unchanged, std::vector<bool>& clone) const;
+  void BuildProjectsInDependencyOrder(cReport& report, const std::vector<bool>& upToDate, const std::vector<bool>& cloneFailed, std::vector<bool>& succeeded);
+  void AnalyseCriticalPath(cReport& report) const;
+
+  // Fingerprints
+  string_t GetRevision(const cProject& project) const;
+  string_t GetRemoteRevision(const cProject& project) const;
+  void GetUnselectedRevisions(std::vector<string_t>& unselectedRevisions) const;
+  string_t GetFingerprint(size_t iProject, const std::vector<string_t>& revisions, const std::vector<string_t>& unselectedRevisions) const;
+  void LoadFingerprints(std::map<string_t, string_t>& fingerprints);
+  void SaveFingerprints(const std::map<string_t, string_t>& fingerprints) const;
+
+  string_t sXMLFilePath;
+
+  std::vector<cProject> projects;
+  std::unordered_set<string_t> projectNames;
+  cDependencyGraph graph;
+  bool bIsLoaded;
+  bool bIsVerbose;
+
+  std::vector<string_t> selectionPatterns; // Empty to load every project
+  bool bSelectDependencies;
+  bool bSelectDependents;
+
+  // Every project and its dependencies before the selection, fingerprints always cover the whole config so that a selection and a full run
+  // agree on whether a project has changed, empty if nothing was selected
+  std::vector<cProject> allProjects;
+  cDependencyGraph allGraph;
+  std::vector<size_t> allProjectIndices; // The index in allProjects of each selected project
+  std::vector<size_t> selectedProjectIndices; // The index in projects of each project in allProjects, or size_t(-1) if it wasn't selected
+
+  string_t sWorkspaceFolder; // Optional persistent folder that checkouts and build trees are kept in between runs
+  string_t sWorkingFolder;
+
+  string_t sLogFolder; // Each step writes the full output of its commands to its own log file in this folder
+
+  string_t sMirrorFolder; // Optional folder of bare git mirrors, one per remote url, that projects are cloned from
+  std::map<string_t, string_t> mirrors; // Remote url to the local mirror that was updated successfully this run
+
+  string_t sCompilerCacheFolder; // Optional ccache folder that is kept between runs and that every C++ target compiles through
+  string_t sCompilerCacheMaxSize; // Passed to ccache --max-size, such as "20G"
+  bool bIsCompilerCacheValid; // ccache is installed and the folder has been set up this run
+
+  size_t nJobs;
+  size_t nCloneJobs;
+  size_t nCompileJobs;
+  size_t nTestJobs; // Unit tests run at the same time as the builds of other targets, on their own threads
+  uint64_t testTimeoutMS;
+
+  string_t sGenerator; // The generator for targets that don't choose one
+  bool bIsNinjaInstalled;
+  bool bIsNinjaJobServerClient; // ninja 1.13 and later can take their jobs from our jobserver
+
+  bool bFailFast; // Stop every build and test step that is running as soon as one fails
+  std::atomic<bool> bIsCancelled;
+
+  cJobServer jobServer;
+  cAdmissionControl admissionControl;
+
+  string_t sFingerprintsFilePath; // The fingerprint of each project that passed on a previous run
+  bool bUseFingerprints;
+  std::map<std::pair<string_t, string_t>, std::vector<string_t> > passedStepNames; // The steps that each project and target ran when it last passed
+
+  std::vector<cBuildObserver*> observers;
+
+  std::chrono::steady_clock::time_point runStart;
+  mutable std::mutex mutexStepTimings;
+  mutable std::map<string_t, std::vector<cStepTiming> > stepTimings; // When each step of this run started and finished, by project name
+
+  mutable std::mutex mutexError;
+  bool bIsError;
+  string_t sErrorMessage;
+};
+
+cBuildManager::cBuildManager(const string_t& _sXMLFilePath) :
+  sXMLFilePath(_sXMLFilePath),
+  bIsLoaded(false),
+  bIsVerbose(false),
+  bSelectDependencies(false),
+  bSelectDependents(false),
+  bIsCompilerCacheValid(false),
+  nJobs(1),
+  nCloneJobs(8),
+  nCompileJobs(std::max<size_t>(1, std::thread::hardware_concurrency())),
+  nTestJobs(std::max<size_t>(1, std::thread::hardware_concurrency())),
+  testTimeoutMS(10 * 60 * 1000),
+  bIsNinjaInstalled(false),
+  bIsNinjaJobServerClient(false),
+  bFailFast(false),
+  bIsCancelled(false),
+  bUseFingerprints(true),
+  bIsError(false)
+{
+}
+
+bool cBuildManager::IsError() const
+{
+  std::lock_guard<std::mutex> lock(mutexError);
+  return bIsError;
+}
+
+string_t cBuildManager::GetError() const
+{
+  std::lock_guard<std::mutex> lock(mutexError);
+  return sErrorMessage;
+}
+
+void cBuildManager::SetJobs(size_t _nJobs)
+{
+  nJobs = std::max<size_t>(1, _nJobs);
+}
+
+void cBuildManager::SetCloneJobs(size_t _nCloneJobs)
+{
+  nCloneJobs = std::max<size_t>(1, _nCloneJobs);
+}
+
+void cBuildManager::SetCompileJobs(size_t _nCompileJobs)
+{
+  nCompileJobs = std::max<size_t>(1, _nCompileJobs);
+}
+
+void cBuildManager::SetTestJobs(size_t _nTestJobs)
+{
+  nTestJobs = std::max<size_t>(1, _nTestJobs);
+}
+
+void cBuildManager::SetTestTimeoutSeconds(size_t nTestTimeoutSeconds)
+{
+  testTimeoutMS = uint64_t(nTestTimeoutSeconds) * 1000;
+}
+
+void cBuildManager::SetFailFast(bool _bFailFast)
+{
+  bFailFast = _bFailFast;
+}
+
+void cBuildManager::SetGenerator(const string_t& _sGenerator)
+{
+  sGenerator = _sGenerator;
+}
+
+void cBuildManager::SetPressureThresholds(size_t nMemoryPressurePercent, size_t nCPUPressurePercent)
+{
+  admissionControl.SetPressureThresholds(nMemoryPressurePercent, nCPUPressurePercent);
+}
+
+void cBuildManager::SetWorkspaceFolder(const string_t& _sWorkspaceFolder)
+{
+  sWorkspaceFolder = _sWorkspaceFolder;
+}
+
+void cBuildManager::SetMirrorFolder(const string_t& _sMirrorFolder)
+{
+  sMirrorFolder = _sMirrorFolder;
+}
+
+void cBuildManager::SetFingerprintsFilePath(const string_t& _sFingerprintsFilePath)
+{
+  sFingerprintsFilePath = _sFingerprintsFilePath;
+}
+
+void cBuildManager::SetUseFingerprints(bool _bUseFingerprints)
+{
+  bUseFingerprints = _bUseFingerprints;
+}
+
+void cBuildManager::SetVerbose(bool _bVerbose)
+{
+  bIsVerbose = _bVerbose;
+}
+
+void cBuildManager::AddObserver(cBuildObserver* pObserver)
+{
+  observers.push_back(pObserver);
+}
+
+void cBuildManager::SetSelection(const std::vector<string_t>& patterns, bool bWithDependencies, bool bWithDependents)
+{
+  selectionPatterns = patterns;
+  bSelectDependencies = bWithDependencies;
+  bSelectDependents = bWithDependents;
+}
+
+void cBuildManager::NotifyStepStarted(const string_t& sProject, const string_t& sTarget, const string_t& sStep) const
+{
+  {
+    cStepTiming timing;
+    timing.sTarget = sTarget;
+    timing.sStep = sStep;
+    timing.startMS = GetElapsedMS(runStart);
+    timing.finishMS = timing.startMS;
+    timing.bIsFinished = false;
+
+    std::lock_guard<std::mutex> lock(mutexStepTimings);
+    stepTimings[sProject].push_back(timing);
+  }
+
+  const size_t n = observers.size();
+  for (size_t i = 0; i < n; i++) observers[i]->OnStepStarted(sProject, sTarget, sStep);
+}
+
+void cBuildManager::NotifyStepFinished(const string_t& sProject, const string_t& sTarget, const string_t& sStep, bool bPassed, const cResourceUsage& usage) const
+{
+  {
+    const uint64_t finishMS = GetElapsedMS(runStart);
+
+    std::lock_guard<std::mutex> lock(mutexStepTimings);
+    std::vector<cStepTiming>& timings = stepTimings[sProject];
+    for (size_t i = timings.size(); i > 0; i--) {
+      cStepTiming& timing = timings[i - 1];
+      if (!timing.bIsFinished && (timing.sTarget == sTarget) && (timing.sStep == sStep)) {
+        timing.finishMS = finishMS;
+        timing.bIsFinished = true;
+        break;
+      }
+    }
+  }
+
+  const size_t n = observers.size();
+  for (size_t i = 0; i < n; i++) observers[i]->OnStepFinished(sProject, sTarget, sStep, bPassed, usage);
+}
+
+void cBuildManager::SetCompilerCache(const string_t& _sCompilerCacheFolder, const string_t& _sCompilerCacheMaxSize)
+{
+  sCompilerCacheFolder = _sCompilerCacheFolder;
+  sCompilerCacheMaxSize = _sCompilerCacheMaxSize;
+}
+
+void cBuildManager::SetLogFolder(const string_t& _sLogFolder)
+{
+  sLogFolder = _sLogFolder;
+}
+
+void cBuildManager::SetError(const string_t& _sErrorMessage)
+{
+  std::lock_guard<std::mutex> lock(mutexError);
+  bIsError = true;
+  sErrorMessage = _sErrorMessage;
+  LOGERROR<<sErrorMessage<<std::endl;
+}
+
+void cBuildManager::ClearError()
+{
+  std::lock_guard<std::mutex> lock(mutexError);
+  bIsError = false;
+  sErrorMessage.clear();
+}
+
+/*
+<build>
+  <project name="PostCodes" url="git://github.com/pilkch/postcodes.git" folder="postcodes">
+    <target name="PostCodes" application="postcodes"/>
+  </project>
+
+  <project name="Allocator" url="git://github.com/pilkch/allocator.git" folder="allocator">
+    <target name="Allocator" application="allocator"/>
+  </project>
+
+  <project name="Library" url="git://github.com/pilkch/library.git" folder="library">
+  </project>
+
+  <project name="Buildall" url="git://github.com/pilkch/buildall.git" folder="buildall">
+    <dependency name="Library"/>
+    <target name="Builall" application="buildall"/>
+  </project>
+
+  <project name="Tetris" url="git://github.com/pilkch/tetris.git" folder="tetris">
+    <dependency name="Library"/>
+    <dependency name="Shared"/>
+    <target name="Tetris" application="tetris" folder="project"/>
+  </project>
+
+  <project name="Test" url="git://github.com/pilkch/test.git" folder="test">
+    <dependency name="Library"/>
+    <target name="Test libopengmm Fade In" application="openglmm_fadein" folder="openglmm_fadein"/>
+    <target name="Test libopengmm FBO" application="openglmm_fbo" folder="openglmm_fbo"/>
+    <target name="Test libopengmm Font" application="openglmm_font" folder="openglmm_font"/>
+    <target name="Test libopengmm Gears" application="openglmm_gears" folder="openglmm_gears"/>
+    <target name="Test libopengmm Geometry" application="openglmm_geometry" folder="openglmm_geometry"/>
+    <target name="Test libopengmm Heightmap" application="openglmm_heightmap" folder="openglmm_heightmap"/>
+    <target name="Test Permutations" application="permutations" folder="permutations"/>
+    <target name="Test Size" application="size_test" folder="size_test"/>
+    <target name="Source Cleaner" application="source_cleaner" folder="source_cleaner"/>
+    <target name="Test xdgmm" application="xdgmm" folder="xdgmm"/>
+  </project>
+</build>
+*/
+
+/*
+// Not ready yet
+
+  <project name="Shared" url="https://firestartergame.svn.sourceforge.net/svnroot/firestartergame/shared" folder="shared">
+  </project>
+
+  <project name="OpenSkate" url="https://openskate.svn.sourceforge.net/svnroot/openskate/skate" folder="openskate">
+    <dependency name="Library"/>
+    <dependency name="Shared"/>
+    <target name="OpenSkate" application="skate" folder="project"/>
+  </project>
+
+  <project name="Crank" url="https://firestartergame.svn.sourceforge.net/svnroot/firestartergame/crank" folder="crank">
+    <dependency name="Library"/>
+    <dependency name="Shared"/>
+    <target name="Crank" application="crank" folder="project"/>
+  </project>
+
+  <project name="Drive" url="https://drivecity.svn.sourceforge.net/svnroot/drivecity/drive" folder="drive">
+    <dependency name="Library"/>
+    <dependency name="Shared"/>
+    <target name="Drive" application="drive" folder="project"/>
+  </project>
+
+  <project name="Sudoku" url="git://sudokubang.git.sourceforge.net/gitroot/sudokubang/sudokubang" folder="sudoku">
+    <dependency name="Library"/>
+    <dependency name="Shared"/>
+    <target name="Sudoku" application="sudoku" folder="project"/>
+  </project>
+
+  <project name="FireStarter" url="https://firestartergame.svn.sourceforge.net/svnroot/firestartergame/firestarter" folder="firestarter">
+    <dependency name="Library"/>
+    <dependency name="Shared"/>
+    <target name="FireStarter" application="firestarter" folder="project"/>
+  </project>
+*/
+
+// Turns the elements of build.xml into projects as they are read
+class cBuildManager::cBuildXMLHandler : public cXMLStreamReader::cHandler
+{
+public:
+  cBuildXMLHandler(cBuildManager& manager, const string_t& sFilePath, std::vector<string_t>& includes);
+
+  virtual bool OnStartElement(const std::string& sName, const cXMLStreamReader::cAttributes& attributes);
+  virtual bool OnEndElement(const std::string& sName);
+
+private:
+  bool OnProject(const cXMLStreamReader::cAttributes& attributes);
+  bool OnInclude(const cXMLStreamReader::cAttributes& attributes);
+
+  cBuildManager& manager;
+  string_t sFilePath;
+  std::vector<string_t>& includes; // The files that are being read, to catch a file that includes itself
+  size_t depth;
+  bool bIsInProject;
+};
+
+cBuildManager::cBuildXMLHandler::cBuildXMLHandler(cBuildManager& _manager, const string_t& _sFilePath, std::vector<string_t>& _includes) :
+  manager(_manager),
+  sFilePath(_sFilePath),
+  includes(_includes),
+  depth(0),
+  bIsInProject(false)
+{
+}
+
+bool cBuildManager::cBuildXMLHandler::OnStartElement(const std::string& sName, const cXMLStreamReader::cAttributes& attributes)
+{
+  depth++;
+
+  if (depth == 1) {
+    if (sName == "build") return true;
+    manager.SetError(TEXT("\"") + sFilePath + TEXT("\" does not contain a build root node"));
+    return false;
+  }
+
+  if (depth == 2) {
+    if (sName == "project") return OnProject(attributes);
+    if (sName == "include") return OnInclude(attributes);
+
+    LOGERROR<<TEXT("\"")<<sFilePath<<TEXT("\" contains an unknown type \"")<<spitfire::string::ToString_t(sName)<<TEXT("\"")<<std::endl;
+    return true;
+  }
+
+  if ((depth != 3) || !bIsInProject) return true;
+
+  cProject& project = manager.projects.back();
+
+  if (sName == "dependency") {
+    //<dependency name="Library"/>
+    string_t sDependency;
+    if (!attributes.GetAttribute("name", sDependency)) {
+      manager.SetError(TEXT("build.xml contains a dependency without a name"));
+      return false;
+    }
+
+    project.dependenciesAsString.push_back(sDependency);
+  } else if (sName == "target") {
+    //<target name="OpenSkate" application="skate" folder="project"/>
+    project.targets.push_back(cTarget());
+    cTarget& target = project.targets.back();
+
+    if (!attributes.GetAttribute("name", target.sName)) {
+      manager.SetError(TEXT("build.xml project contains a target without a name"));
+      return false;
+    }
+
+    if (!attributes.GetAttribute("application", target.sApplication)) {
+      manager.SetError(TEXT("build.xml project contains a target without a application"));
+      return false;
+    }
+
+    attributes.GetAttribute("folder", target.sFolder);
+
+    string_t sValue;
+    if (attributes.GetAttribute("memory", sValue) && !ParseMemorySizeKB(sValue, target.memoryKB)) {
+      manager.SetError(TEXT("build.xml target \"") + target.sName + TEXT("\" has an invalid memory size \"") + sValue + TEXT("\""));
+      return false;
+    }
+    if (attributes.GetAttribute("cores", sValue)) target.cores = size_t(std::max(1, atoi(spitfire::string::ToUTF8(sValue).c_str())));
+
+    if (attributes.GetAttribute("generator", target.sGenerator) && (target.sGenerator != TEXT("ninja")) && (target.sGenerator != TEXT("make"))) {
+      manager.SetError(TEXT("build.xml target \"") + target.sName + TEXT("\" has an unknown generator \"") + target.sGenerator + TEXT("\", expected ninja or make"));
+      return false;
+    }
+
+    if (manager.bIsVerbose) LOG<<TEXT("  target \"")<<target.sName<<TEXT("\"")<<std::endl;
+  } else {
+    LOGERROR<<TEXT("build.xml contains a project (\"")<<project.sName<<TEXT("\") with an unknown type \"")<<spitfire::string::ToString_t(sName)<<TEXT("\"")<<std::endl;
+  }
+
+  return true;
+}
+
+bool cBuildManager::cBuildXMLHandler::OnEndElement(const std::string& sName)
+{
+  if (depth == 2) bIsInProject = false;
+  depth--;
+  return true;
+}
+
+bool cBuildManager::cBuildXMLHandler::OnProject(const cXMLStreamReader::cAttributes& attributes)
+{
+  //<project name="Tetris" url="git://github.com/pilkch/tetris.git" folder="tetris">
+  manager.projects.push_back(cProject());
+  cProject& project = manager.projects.back();
+
+  if (!attributes.GetAttribute("name", project.sName)) {
+    manager.SetError(TEXT("build.xml contains a project without a name"));
+    return false;
+  }
+
+  if (!attributes.GetAttribute("url", project.sURL)) {
+    manager.SetError(TEXT("build.xml contains a project without a url"));
+    return false;
+  }
+
+  if (!attributes.GetAttribute("folder", project.sFolderName)) {
+    manager.SetError(TEXT("build.xml contains a project without a folder"));
+    return false;
+  }
+
+  if (!manager.projectNames.insert(project.sName).second) {
+    manager.SetError(TEXT("build.xml contains more than one project called \"") + project.sName + TEXT("\""));
+    return false;
+  }
+
+  if (manager.bIsVerbose) LOG<<TEXT("project \"")<<project.sName<<TEXT("\" url \"")<<project.sURL<<TEXT("\" folder \"")<<project.sFolderName<<TEXT("\"")<<std::endl;
+
+  bIsInProject = true;
+  return true;
+}
+
+bool cBuildManager::cBuildXMLHandler::OnInclude(const cXMLStreamReader::cAttributes& attributes)
+{
+  //<include file="games.xml"/>
+  string_t sIncludeFilePath;
+  if (!attributes.GetAttribute("file", sIncludeFilePath)) {
+    manager.SetError(TEXT("\"") + sFilePath + TEXT("\" contains an include without a file"));
+    return false;
+  }
+
+  // Relative paths are relative to the folder of the file that includes them
+  if (sIncludeFilePath[0] != TEXT('/')) {
+    const size_t slash = sFilePath.rfind(TEXT('/'));
+    if (slash != string_t::npos) sIncludeFilePath = spitfire::filesystem::MakeFilePath(sFilePath.substr(0, slash), sIncludeFilePath);
+  }
+
+  // Compare canonical paths so that a file can't get around this by including itself through a different path
+  char* szRealPath = realpath(spitfire::string::ToUTF8(sIncludeFilePath).c_str(), nullptr);
+  if (szRealPath == nullptr) {
+    manager.SetError(TEXT("\"") + sFilePath + TEXT("\" includes \"") + sIncludeFilePath + TEXT("\" which doesn't exist"));
+    return false;
+  }
+  sIncludeFilePath = spitfire::string::ToString_t(szRealPath);
+  free(szRealPath);
+
+  if (std::find(includes.begin(), includes.end(), sIncludeFilePath) != includes.end()) {
+    manager.SetError(TEXT("\"") + sFilePath + TEXT("\" includes \"") + sIncludeFilePath + TEXT("\" which is already being read"));
+    return false;
+  }
+
+  return manager.LoadFromXMLFile(sIncludeFilePath, includes);
+}
+
+/*
+<build>
+  <include file="games.xml"/>
+</build>
+*/
+
+bool cBuildManager::LoadFromXMLFile(const string_t& sFilePath, std::vector<string_t>& includes)
+{
+  if (bIsVerbose) LOG<<TEXT("cBuildManager::LoadFromXMLFile \"")<<sFilePath<<TEXT("\"")<<std::endl;
+
+  if (!spitfire::filesystem::FileExists(sFilePath)) {
+    SetError(TEXT("XML File \"") + sFilePath + TEXT("\" doesn't exist"));
+    return false;
+  }
+
+  // The file that is being read is remembered by its canonical path, includes are already canonical
+  char* szRealPath = realpath(spitfire::string::ToUTF8(sFilePath).c_str(), nullptr);
+  includes.push_back((szRealPath != nullptr) ? spitfire::string::ToString_t(szRealPath) : sFilePath);
+  free(szRealPath);
+
+  cBuildXMLHandler handler(*this, sFilePath, includes);
+  cXMLStreamReader reader;
+  const bool bResult = reader.ReadFromFile(sFilePath, handler);
+  if (!bResult && !reader.GetError().empty()) SetError(TEXT("build.xml does not contain valid xml data, ") + reader.GetError());
+
+  includes.pop_back();
+
+  return bResult;
+}
+
+// build.xml is read as a stream, projects are added as they are read and nothing is printed per project unless we are verbose
+void cBuildManager::LoadFromXMLFile()
+{
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  projects.clear();
+  projectNames.clear();
+
+  std::vector<string_t> includes;
+  if (!LoadFromXMLFile(sXMLFilePath, includes)) return;
+
+  CreateDependencyGraph();
+
+  LOG<<TEXT("cBuildManager::LoadFromXMLFile Loaded ")<<projects.size()<<TEXT(" projects from \"")<<sXMLFilePath<<TEXT("\" in ")<<GetElapsedMS(start)<<TEXT(" ms")<<std::endl;
+}
+
+// A dependency cycle can never be built so it is an error in build.xml
+void cBuildManager::CreateDependencyGraph()
+{
+  graph.Create(projects);
+
+  const std::vector<size_t>& cycle = graph.GetCycle();
+  if (!cycle.empty()) {
+    string_t sCycle;
+    for (size_t i = 0; i < cycle.size(); i++) {
+      if (i != 0) sCycle += TEXT(" -> ");
+      sCycle += projects[cycle[i]].sName;
+    }
+    SetError(TEXT("build.xml contains a dependency cycle ") + sCycle);
+  }
+}
+
+// Throw away every project that isn't selected, a project that was only selected by the name of one of its targets keeps just the targets
+// that were selected
+// NOTE: Dependencies on projects that aren't selected are dropped, they are assumed to be checked out and built already
+void cBuildManager::SelectProjects()
+{
+  allProjects.clear();
+  allProjectIndices.clear();
+  selectedProjectIndices.clear();
+
+  if (selectionPatterns.empty()) return;
+
+  auto IsMatch = [&](const string_t& sName)
+  {
+    const std::string sNameUTF8 = spitfire::string::ToUTF8(sName);
+    for (size_t i = 0; i < selectionPatterns.size(); i++) {
+      if (fnmatch(spitfire::string::ToUTF8(selectionPatterns[i]).c_str(), sNameUTF8.c_str(), 0) == 0) return true;
+    }
+    return false;
+  };
+
+  const size_t nProjects = projects.size();
+
+  std::vector<bool> selected(nProjects, false);
+  std::vector<bool> allTargets(nProjects, false);
+  std::vector<std::vector<bool> > selectedTargets(nProjects);
+  for (size_t i = 0; i < nProjects; i++) {
+    const cProject& project = projects[i];
+    selectedTargets[i].assign(project.targets.size(), false);
+    if (IsMatch(project.sName)) {
+      selected[i] = true;
+      allTargets[i] = true;
+      continue;
+    }
+
+    for (size_t j = 0; j < project.targets.size(); j++) {
+      if (IsMatch(project.targets[j].sName)) {
+        selected[i] = true;
+        selectedTargets[i][j] = true;
+      }
+    }
+  }
+
+  // Dependencies and dependents are both found from the projects that matched, so that the dependents of a dependency aren't selected too
+  const std::vector<bool> matched(selected);
+
+  if (bSelectDependencies) {
+    std::vector<size_t> allDependencies;
+    for (size_t i = 0; i < nProjects; i++) {
+      if (!matched[i]) continue;
+      graph.GetAllDependencies(i, allDependencies);
+      for (size_t j = 0; j < allDependencies.size(); j++) {
+        selected[allDependencies[j]] = true;
+        allTargets[allDependencies[j]] = true;
+      }
+    }
+  }
+
+  if (bSelectDependents) {
+    // Walk the dependents of the matched projects, visiting each project once
+    std::vector<bool> visited(matched);
+    std::vector<size_t> stack;
+    for (size_t i = 0; i < nProjects; i++) {
+      if (matched[i]) stack.push_back(i);
+    }
+    while (!stack.empty()) {
+      const size_t iProject = stack.back();
+      stack.pop_back();
+
+      const std::vector<size_t>& dependents = graph.GetDependents(iProject);
+      for (size_t j = 0; j < dependents.size(); j++) {
+        const size_t iDependent = dependents[j];
+        if (visited[iDependent]) continue;
+
+        visited[iDependent] = true;
+        selected[iDependent] = true;
+        allTargets[iDependent] = true;
+        stack.push_back(iDependent);
+      }
+    }
+  }
+
+  std::vector<cProject> selectedProjects;
+  std::vector<size_t> selectedIndices;
+  std::unordered_set<string_t> names;
+  for (size_t i = 0; i < nProjects; i++) {
+    if (!selected[i]) continue;
+
+    cProject project = projects[i];
+    if (!allTargets[i]) {
+      project.targets.clear();
+      for (size_t j = 0; j < projects[i].targets.size(); j++) {
+        if (selectedTargets[i][j]) project.targets.push_back(projects[i].targets[j]);
+      }
+    }
+
+    selectedProjects.push_back(project);
+    selectedIndices.push_back(i);
+    names.insert(project.sName);
+  }
+
+  if (selectedProjects.empty()) {
+    SetError(TEXT("No projects or targets match the selection"));
+    return;
+  }
+
+  LOG<<TEXT("cBuildManager::SelectProjects Selected ")<<selectedProjects.size()<<TEXT(" of ")<<nProjects<<TEXT(" projects")<<std::endl;
+
+  for (size_t i = 0; i < selectedProjects.size(); i++) {
+    std::vector<string_t>& dependenciesAsString = selectedProjects[i].dependenciesAsString;
+    dependenciesAsString.erase(std::remove_if(dependenciesAsString.begin(), dependenciesAsString.end(), [&](const string_t& sName) { return (names.find(sName) == names.end()); }), dependenciesAsString.end());
+  }
+
+  allGraph = graph;
+  selectedProjectIndices.assign(nProjects, size_t(-1));
+  for (size_t i = 0; i < selectedIndices.size(); i++) selectedProjectIndices[selectedIndices[i]] = i;
+  allProjectIndices.swap(selectedIndices);
+  projects.swap(selectedProjects);
+  allProjects.swap(selectedProjects);
+  projectNames.swap(names);
+
+  CreateDependencyGraph();
+}
+
+// installedTools remembers each tool that has already been looked for, so that we only run which once per tool rather than once per project
+bool cBuildManager::CheckPrerequisites(cReport& report, const cProject& project, std::map<string_t, bool>& installedTools)
+{
+  const bool bIsGit = project.IsProtocolGit();
+
+  // Find out whether the executable for this protocol is installed
+  string_t sExecutable;
+  if (bIsGit) sExecutable = "git";
+  else sExecutable = "svn";
+
+  std::map<string_t, bool>::const_iterator iter = installedTools.find(sExecutable);
+  if (iter == installedTools.end()) {
+    const string_t sCommand = "which " + sExecutable;
+
+    int iReturnCode = -1;
+    const string_t sOutput = spitfire::platform::PipeReadToString(sCommand, iReturnCode);
+    iter = installedTools.insert(std::make_pair(sExecutable, (sOutput.find(sExecutable) != std::string::npos))).first;
+  }
+
+  const bool bFound = iter->second;
+  if (!bFound) SetError("Tool \"" + sExecutable + "\" for project \"" + project.sName + "\" has not been installed yet");
+  return bFound;
+}
+
+bool cBuildManager::Clone(cReport& report, const cProject& project)
+{
+  const bool bIsGit = project.IsProtocolGit();
+
+  const string_t sProjectFolder = spitfire::filesystem::MakeFilePath(sWorkingFolder, project.sFolderName);
+
+  // If we have a local mirror of this repository then clone from that instead, git hardlinks the objects of a local clone so this is almost instant
+  string_t sURL = project.sURL;
+  bool bShallow = true;
+  if (bIsGit) {
+    std::map<string_t, string_t>::const_iterator iter = mirrors.find(project.sURL);
+    if (iter != mirrors.end()) {
+      sURL = iter->second;
+      bShallow = false;
+    }
+  }
+
+  std::vector<cChildProcess> commands;
+  if (spitfire::filesystem::DirectoryExists(sProjectFolder)) {
+    // This is a persistent workspace so update the existing checkout in place, untracked files such as the in source build trees are left alone
+    if (bIsGit && spitfire::filesystem::DirectoryExists(spitfire::filesystem::MakeFilePath(sProjectFolder, TEXT(".git")))) {
+      commands.resize(3);
+      for (size_t i = 0; i < commands.size(); i++) {
+        commands[i].SetWorkingFolder(sProjectFolder);
+        commands[i].AddArgument(TEXT("git"));
+      }
+      commands[0].AddArgument(TEXT("remote"));
+      commands[0].AddArgument(TEXT("set-url"));
+      commands[0].AddArgument(TEXT("origin"));
+      commands[0].AddArgument(sURL);
+      commands[1].AddArgument(TEXT("fetch"));
+      if (bShallow) commands[1].AddArgument(TEXT("--depth=1"));
+      commands[1].AddArgument(TEXT("origin"));
+      commands[1].AddArgument(TEXT("HEAD"));
+      commands[2].AddArgument(TEXT("reset"));
+      commands[2].AddArgument(TEXT("--hard"));
+      commands[2].AddArgument(TEXT("FETCH_HEAD"));
+    } else if (!bIsGit && spitfire::filesystem::DirectoryExists(spitfire::filesystem::MakeFilePath(sProjectFolder, TEXT(".svn")))) {
+      commands.resize(2);
+      commands[0].AddArgument(TEXT("svn"));
+      commands[0].AddArgument(TEXT("revert"));
+      commands[0].AddArgument(TEXT("-R"));
+      commands[0].AddArgument(sProjectFolder);
+      commands[1].AddArgument(TEXT("svn"));
+      commands[1].AddArgument(TEXT("update"));
+      commands[1].AddArgument(sProjectFolder);
+    } else {
+      SetError(TEXT("cBuildManager::Clone Folder \"") + sProjectFolder + TEXT("\" already exists but is not a ") + (bIsGit ? TEXT("git") : TEXT("svn")) + TEXT(" checkout"));
+      report.SetTestResultFailed(project.sName, TEXT("clone"));
+      return false;
+    }
+  } else {
+    commands.resize(1);
+    if (bIsGit) {
+      commands[0].AddArgument(TEXT("git"));
+      commands[0].AddArgument(TEXT("clone"));
+      if (bShallow) commands[0].AddArgument(TEXT("--depth=1"));
+    } else {
+      commands[0].AddArgument(TEXT("svn"));
+      commands[0].AddArgument(TEXT("co"));
+    }
+    commands[0].AddArgument(sURL);
+    commands[0].AddArgument(sProjectFolder);
+  }
+
+  const string_t sLogFilePath = GetLogFilePath(project.sName, TEXT(""), TEXT("clone"));
+
+  string_t sCommand;
+  std::string sBuffer;
+  cResourceUsage usage;
+  NotifyStepStarted(project.sName, TEXT(""), TEXT("clone"));
+  const int iReturnCode = RunCommands(commands, sLogFilePath, sCommand, sBuffer, usage);
+  report.SetTestResourceUsage(project.sName, TEXT("clone"), usage);
+  NotifyStepFinished(project.sName, TEXT(""), TEXT("clone"), (iReturnCode == 0), usage);
+  if (iReturnCode != 0) {
+    ostringstream_t o;
+    o<<TEXT("cBuildManager::Clone Process \"")<<sCommand<<TEXT("\" returned ")<<iReturnCode<<TEXT(", log=\"")<<sLogFilePath<<TEXT("\", sBuffer=\"")<<spitfire::string::ToString_t(sBuffer)<<TEXT("\"")<<std::endl;
+    SetError(o.str());
+    report.SetTestResultFailed(project.sName, TEXT("clone"));
+    return false;
+  }
+
+  #ifdef BUILD_DEBUG
+  LOG<<TEXT("cBuildManager::Clone Process \"")<<sCommand<<TEXT("\" returned ")<<iReturnCode<<TEXT(", sBuffer=\"")<<spitfire::string::ToString_t(sBuffer)<<TEXT("\"")<<std::endl;
+  #endif
+  report.SetTestResultPassed(project.sName, TEXT("clone"));
+  return true;
+}
+
+string_t cBuildManager::GetTargetFolder(const cProject& project, const cTarget& target) const
+{
+  return spitfire::filesystem::MakeFilePath(sWorkingFolder, project.sFolderName, target.sFolder);
+}
+
+bool cBuildManager::IsJavaTarget(const cProject& project, const cTarget& target) const
+{
+  const string_t sTargetFolder = GetTargetFolder(project, target);
+
+  // If there is a build.xml file within this directory then it is probably an Ant make file and we should treat it as a Java project
+  const string_t sBuildXML = spitfire::filesystem::MakeFilePath(sTargetFolder, TEXT("build.xml"));
+  return spitfire::filesystem::FileExists(sBuildXML);
+}
+
+bool cBuildManager::IsNinjaTarget(const cTarget& target) const
+{
+  const string_t& sTargetGenerator = target.sGenerator.empty() ? sGenerator : target.sGenerator;
+  if (!bIsNinjaInstalled || (sTargetGenerator == TEXT("make"))) return false;
+
+  // An older ninja can't share the jobserver, so it is only used when it is asked for
+  return ((sTargetGenerator == TEXT("ninja")) || bIsNinjaJobServerClient);
+}
+
+// A build tree can only be generated for one generator, if it was generated for the other one we have to throw away the cache and start again
+void cBuildManager::ResetBuildTreeIfGeneratorChanged(const string_t& sTargetFolder, const string_t& sGenerator) const
+{
+  const string_t sCacheFilePath = spitfire::filesystem::MakeFilePath(sTargetFolder, TEXT("CMakeCache.txt"));
+
+  std::string sPreviousGenerator;
+  {
+    std::ifstream file(spitfire::string::ToUTF8(sCacheFilePath).c_str());
+    const std::string sPrefix = "CMAKE_GENERATOR:INTERNAL=";
+    std::string sLine;
+    while (std::getline(file, sLine)) {
+      if (sLine.compare(0, sPrefix.length(), sPrefix) == 0) {
+        sPreviousGenerator = sLine.substr(sPrefix.length());
+        break;
+      }
+    }
+  }
+
+  if (sPreviousGenerator.empty() || (spitfire::string::ToString_t(sPreviousGenerator) == sGenerator)) return;
+
+  LOG<<TEXT("cBuildManager::ResetBuildTreeIfGeneratorChanged \"")<<sTargetFolder<<TEXT("\" was generated for \"")<<spitfire::string::ToString_t(sPreviousGenerator)<<TEXT("\", generating it again for \"")<<sGenerator<<TEXT("\"")<<std::endl;
+
+  std::remove(spitfire::string::ToUTF8(sCacheFilePath).c_str());
+
+  cChildProcess process;
+  process.SetWorkingFolder(sTargetFolder);
+  process.AddArgument(TEXT("cmake"));
+  process.AddArgument(TEXT("-E"));
+  process.AddArgument(TEXT("remove_directory"));
+  process.AddArgument(TEXT("CMakeFiles"));
+  std::string sBuffer;
+  if (process.Run(sBuffer) != 0) LOGERROR<<TEXT("cBuildManager::ResetBuildTreeIfGeneratorChanged Failed to remove \"CMakeFiles\" from \"")<<sTargetFolder<<TEXT("\"")<<std::endl;
+}
+
+std::vector<string_t> cBuildManager::GetStepNames(const cProject& project, const cTarget& target) const
+{
+  // A target that isn't checked out can't tell us whether it is a Java target, so use the steps it ran when it last passed
+  if (!spitfire::filesystem::DirectoryExists(GetTargetFolder(project, target))) {
+    std::map<std::pair<string_t, string_t>, std::vector<string_t> >::const_iterator iter = passedStepNames.find(std::make_pair(project.sName, target.sName));
+    if (iter != passedStepNames.end()) return iter->second;
+  }
+
+  std::vector<string_t> steps;
+  if (IsJavaTarget(project, target)) {
+    steps.push_back(TEXT("ant build"));
+  } else {
+    steps.push_back(TEXT("cmake"));
+    steps.push_back(IsNinjaTarget(target) ? TEXT("ninja") : TEXT("make"));
+    steps.push_back(TEXT("unittest"));
+  }
+
+  return steps;
+}
+
+// Counts the compilations in a ccache stats log (The CCACHE_STATSLOG setting of ccache 4), each compilation is a "# <source file>" line
+// followed by a line for each counter that it incremented
+// NOTE: Returns false if the log doesn't exist, for example if ccache is too old to write it
+bool ReadCompilerCacheStats(const string_t& sFilePath, uint64_t& hits, uint64_t& misses)
+{
+  hits = 0;
+  misses = 0;
+
+  std::ifstream file(spitfire::string::ToUTF8(sFilePath).c_str());
+  if (!file.is_open()) return false;
+
+  std::string sLine;
+  while (std::getline(file, sLine)) {
+    if ((sLine == "direct_cache_hit") || (sLine == "preprocessed_cache_hit")) hits++;
+    else if (sLine == "cache_miss") misses++;
+  }
+
+  return true;
+}
+
+bool cBuildManager::BuildJava(cReport& report, const cProject& project, const cTarget& target)
+{
+  // Run ant build
+  {
+    cChildProcess process;
+    process.SetWorkingFolder(GetTargetFolder(project, target));
+    process.AddArgument(TEXT("ant"));
+    process.AddArgument(TEXT("build"));
+    if (bFailFast) process.SetCancelFlag(bIsCancelled);
+    const string_t sLogFilePath = GetLogFilePath(project.sName, target.sName, TEXT("ant build"));
+    process.SetLogFile(sLogFilePath, false);
+    const string_t sCommand = process.GetCommandLine();
+
+    std::string sBuffer;
+    cResourceUsage usage;
+    admissionControl.Acquire(project.sName + TEXT(" ") + target.sName + TEXT(" ant build"), target.memoryKB, target.cores);
+    NotifyStepStarted(project.sName, target.sName, TEXT("ant build"));
+    const int iReturnCode = process.Run(sBuffer, usage);
+    admissionControl.Release(target.memoryKB, target.cores);
+    report.SetTestResourceUsage(project.sName, target.sName, TEXT("ant build"), usage);
+    NotifyStepFinished(project.sName, target.sName, TEXT("ant build"), (iReturnCode == 0), usage);
+    if (iReturnCode == cChildProcess::iReturnCodeCancelled) return false; // Another step failed with --fail-fast, this one is left as not run
+    else if (iReturnCode != 0) {
+      ostringstream_t o;
+      o<<TEXT("cBuildManager::BuildJava ant build process \"")<<sCommand<<TEXT("\" returned ")<<iReturnCode<<TEXT(", log=\"")<<sLogFilePath<<TEXT("\", sBuffer=\"")<<spitfire::string::ToString_t(sBuffer)<<TEXT("\"")<<std::endl;
+      SetError(o.str());
+      report.SetTestResultFailed(project.sName, target.sName, TEXT("ant build"));
+      return false;
+    } else {
+      #ifdef BUILD_DEBUG
+      LOG<<TEXT("cBuildManager::BuildJava ant build process \"")<<sCommand<<TEXT("\" returned ")<<iReturnCode<<TEXT(", sBuffer=\"")<<spitfire::string::ToString_t(sBuffer)<<TEXT("\"")<<std::endl;
+      #endif
+      report.SetTestResultPassed(project.sName, target.sName, TEXT("ant build"));
+    }
+  }
+
+  return true;
+}
+
+bool cBuildManager::BuildCPlusPlus(cReport& report, const cProject& project, const cTarget& target)
+{
+  const string_t sTargetFolder = GetTargetFolder(project, target);
+
+  const bool bIsNinja = IsNinjaTarget(target);
+  const string_t sBuildStep = bIsNinja ? TEXT("ninja") : TEXT("make");
+
+  // Run cmake
+  {
+    const string_t sGeneratorName = bIsNinja ? TEXT("Ninja") : TEXT("Unix Makefiles");
+    ResetBuildTreeIfGeneratorChanged(sTargetFolder, sGeneratorName);
+
+    cChildProcess process;
+    process.SetWorkingFolder(sTargetFolder);
+    process.AddArgument(TEXT("cmake"));
+    process.AddArgument(TEXT("-G"));
+    process.AddArgument(sGeneratorName);
+    process.AddArgument(TEXT("."));
+    // Set the launchers even without ccache, so that a build tree that was configured with ccache stops using it
+    const string_t sLauncher = bIsCompilerCacheValid ? TEXT("ccache") : TEXT("");
+    process.AddArgument(TEXT("-DCMAKE_C_COMPILER_LAUNCHER=") + sLauncher);
+    process.AddArgument(TEXT("-DCMAKE_CXX_COMPILER_LAUNCHER=") + sLauncher);
+    if (bIsCompilerCacheValid) AddCompilerCacheToChildProcess(process);
+    if (bFailFast) process.SetCancelFlag(bIsCancelled);
+    const string_t sLogFilePath = GetLogFilePath(project.sName, target.sName, TEXT("cmake"));
+    process.SetLogFile(sLogFilePath, false);
+    const string_t sCommand = process.GetCommandLine();
+
+    std::string sBuffer;
+    cResourceUsage usage;
+    admissionControl.Acquire(project.sName + TEXT(" ") + target.sName + TEXT(" cmake"), 0, 1);
+    NotifyStepStarted(project.sName, target.sName, TEXT("cmake"));
+    const int iReturnCode = process.Run(sBuffer, usage);
+    admissionControl.Release(0, 1);
+    report.SetTestResourceUsage(project.sName, target.sName, TEXT("cmake"), usage);
+    NotifyStepFinished(project.sName, target.sName, TEXT("cmake"), (iReturnCode == 0), usage);
+    if (iReturnCode == cChildProcess::iReturnCodeCancelled) return false; // Another step failed with --fail-fast, this one is left as not run
+    else if (iReturnCode != 0) {
+      ostringstream_t o;
+      o<<TEXT("cBuildManager::BuildCPlusPlus cmake process \"")<<sCommand<<TEXT("\" returned ")<<iReturnCode<<TEXT(", log=\"")<<sLogFilePath<<TEXT("\", sBuffer=\"")<<spitfire::string::ToString_t(sBuffer)<<TEXT("\"")<<std::endl;
+      SetError(o.str());
+      report.SetTestResultFailed(project.sName, target.sName, TEXT("cmake"));
+      return false;
+    } else {
+      #ifdef BUILD_DEBUG
+      LOG<<TEXT("cBuildManager::BuildCPlusPlus cmake process \"")<<sCommand<<TEXT("\" returned ")<<iReturnCode<<TEXT(", sBuffer=\"")<<spitfire::string::ToString_t(sBuffer)<<TEXT("\"")<<std::endl;
+      #endif
+      report.SetTestResultPassed(project.sName, target.sName, TEXT("cmake"));
+    }
+  }
+
+  // Run make or ninja
+  {
+    const bool bIsNinjaWithJobServer = (bIsNinja && bIsNinjaJobServerClient && jobServer.IsFifo());
+    const size_t nNinjaJobs = std::min(std::max(target.cores, std::max<size_t>(1, nCompileJobs / nJobs)), std::max<size_t>(1, jobServer.GetTokens()));
+    const size_t nTokens = (!bIsNinja || bIsNinjaWithJobServer) ? 1 : nNinjaJobs;
+
+    cChildProcess process;
+    process.SetWorkingFolder(sTargetFolder);
+    if (bIsNinjaWithJobServer) {
+      // Passing -j would make ninja ignore the jobserver
+      process.AddArgument(TEXT("ninja"));
+      jobServer.AddFifoToChildProcess(process);
+    } else if (bIsNinja) {
+      // An older ninja can't take its jobs from our jobserver, so it gets an even share of the compile jobs (Or the cores that the target
+      // asks for), and holds that many tokens while it runs so that the makes and other ninjas running at the same time start fewer jobs
+      ostringstream_t jobs;
+      jobs<<nNinjaJobs;
+      process.AddArgument(TEXT("ninja"));
+      process.AddArgument(TEXT("-j"));
+      process.AddArgument(jobs.str());
+    } else {
+      process.AddArgument(TEXT("make"));
+      if (jobServer.IsValid()) jobServer.AddToChildProcess(process);
+    }
+    if (bFailFast) process.SetCancelFlag(bIsCancelled);
+    const string_t sLogFilePath = GetLogFilePath(project.sName, target.sName, sBuildStep);
+    process.SetLogFile(sLogFilePath, false);
+    const string_t sCommand = process.GetCommandLine();
+
+    // ccache appends a record of each compilation to the stats log, so each target gets its own hit rate even with other targets building
+    const string_t sCompilerCacheStatsFilePath = GetLogFilePath(project.sName, target.sName, TEXT("ccache"));
+    if (bIsCompilerCacheValid) {
+      AddCompilerCacheToChildProcess(process);
+      if (!sCompilerCacheStatsFilePath.empty()) {
+        std::remove(spitfire::string::ToUTF8(sCompilerCacheStatsFilePath).c_str());
+        process.SetEnvironmentVariable(TEXT("CCACHE_STATSLOG"), sCompilerCacheStatsFilePath);
+      }
+    }
+
+    std::string sBuffer;
+    cResourceUsage usage;
+    admissionControl.Acquire(project.sName + TEXT(" ") + target.sName + TEXT(" ") + sBuildStep, target.memoryKB, target.cores);
+    if (jobServer.IsValid()) jobServer.AcquireTokens(nTokens);
+    if (bIsCancelled) {
+      // Another step failed with --fail-fast while we were waiting for a token, this one is left as not run
+      if (jobServer.IsValid()) jobServer.ReleaseTokens(nTokens);
+      admissionControl.Release(target.memoryKB, target.cores);
+      return false;
+    }
+    NotifyStepStarted(project.sName, target.sName, sBuildStep);
+    const int iReturnCode = process.Run(sBuffer, usage);
+    if (jobServer.IsValid()) jobServer.ReleaseTokens(nTokens);
+    admissionControl.Release(target.memoryKB, target.cores);
+    if (bIsCompilerCacheValid && !sCompilerCacheStatsFilePath.empty() && ReadCompilerCacheStats(sCompilerCacheStatsFilePath, usage.compilerCacheHits, usage.compilerCacheMisses)) {
+      LOG<<TEXT("cBuildManager::BuildCPlusPlus \"")<<project.sName<<TEXT(" ")<<target.sName<<TEXT("\" ccache hits ")<<usage.compilerCacheHits<<TEXT(" of ")<<(usage.compilerCacheHits + usage.compilerCacheMisses)<<TEXT(" compilations")<<std::endl;
+    }
+    report.SetTestResourceUsage(project.sName, target.sName, sBuildStep, usage);
+    NotifyStepFinished(project.sName, target.sName, sBuildStep, (iReturnCode == 0), usage);
+    if (iReturnCode == cChildProcess::iReturnCodeCancelled) return false; // Another step failed with --fail-fast, this one is left as not run
+    else if (iReturnCode != 0) {
+      ostringstream_t o;
+      o<<TEXT("cBuildManager::BuildCPlusPlus ")<<sBuildStep<<TEXT(" process \"")<<sCommand<<TEXT("\" returned ")<<iReturnCode<<TEXT(", log=\"")<<sLogFilePath<<TEXT("\", sBuffer=\"")<<spitfire::string::ToString_t(sBuffer)<<TEXT("\"")<<std::endl;
+      SetError(o.str());
+      report.SetTestResultFailed(project.sName, target.sName, sBuildStep);
+      return false;
+    } else {
+      #ifdef BUILD_DEBUG
+      LOG<<TEXT("cBuildManager::BuildCPlusPlus ")<<sBuildStep<<TEXT(" process \"")<<sCommand<<TEXT("\" returned ")<<iReturnCode<<TEXT(", sBuffer=\"")<<spitfire::string::ToString_t(sBuffer)<<TEXT("\"")<<std::endl;
+      #endif
+      report.SetTestResultPassed(project.sName, target.sName, sBuildStep);
+    }
+  }
+
+  return true;
+}
+
+bool cBuildManager::Build(cReport& report, const cProject& project, const cTarget& target)
+{
+  if (IsJavaTarget(project, target)) return BuildJava(report, project, target);
+
+  return BuildCPlusPlus(report, project, target);
+}
+
+bool cBuildManager::TestJava(cReport& report, const cProject& project, const cTarget& target)
+{
+  // TODO: Pass --unittest and actually test the built application
+  /*// Run ant Application
+  {
+    const string_t sCommand = TEXT("ant Application");
+
+    int iReturnCode = -1;
+    std::string sBuffer = spitfire::platform::PipeReadToString(sCommand, iReturnCode);
+    if (iReturnCode != 0) {
+      ostringstream_t o;
+      o<<TEXT("cBuildManager::TestJava ant Application process \"")<<sCommand<<TEXT("\" returned ")<<iReturnCode<<TEXT(", sBuffer=\"")<<spitfire::string::ToString_t(sBuffer)<<TEXT("\"")<<std::endl;
+      SetError(o.str());
+      report.SetTestResultFailed(project.sName, TEXT("ant Application"));
+      return;
+    } else {
+      #ifdef BUILD_DEBUG
+      LOG<<TEXT("cBuildManager::TestJava ant Application process \"")<<sCommand<<TEXT("\" returned ")<<iReturnCode<<TEXT(", sBuffer=\"")<<spitfire::string::ToString_t(sBuffer)<<TEXT("\"")<<std::endl;
+      #endif
+      report.SetTestResultPassed(project.sName, target.sName, TEXT("ant Application"));
+    }
+  }*/
+
+  return true;
+}
+
+// Reads the result of each test from the output of an application run with --unittest
+// spitfire::util::unittest prints a line for each test that ends with the name of the test and PASSED or FAILED, anything else is ignored
+void ParseUnitTestResults(std::istream& output, std::vector<std::pair<string_t, bool> >& results)
+{
+  results.clear();
+
+  std::string sLine;
+  while (std::getline(output, sLine)) {
+    std::istringstream line(sLine);
+    std::vector<std::string> words;
+    std::string sWord;
+    while (line>>sWord) words.push_back(sWord);
+
+    const size_t n = words.size();
+    if ((n < 2) || ((words[n - 1] != "PASSED") && (words[n - 1] != "FAILED"))) continue;
+
+    // The name may be quoted or followed by a colon
+    std::string sName = words[n - 2];
+    while (!sName.empty() && ((sName.back() == ':') || (sName.back() == '"') || (sName.back() == '\''))) sName.pop_back();
+    while (!sName.empty() && ((sName[0] == '"') || (sName[0] == '\''))) sName.erase(0, 1);
+    if (sName.empty()) continue;
+
+    results.push_back(std::make_pair(spitfire::string::ToString_t(sName), (words[n - 1] == "PASSED")));
+  }
+}
+
+bool cBuildManager::TestCPlusPlus(cReport& report, const cProject& project, const cTarget& target)
+{
+  const string_t sTargetFolder = GetTargetFolder(project, target);
+
+  // Run application with unittest parameter, if it hangs it and everything it started are killed once the timeout is up
+  cChildProcess process;
+  process.SetWorkingFolder(sTargetFolder);
+  process.AddArgument(spitfire::filesystem::MakeFilePath(sTargetFolder, target.sApplication));
+  process.AddArgument(TEXT("--unittest"));
+  process.SetTimeoutMS(testTimeoutMS);
+  if (bFailFast) process.SetCancelFlag(bIsCancelled);
+  const string_t sLogFilePath = GetLogFilePath(project.sName, target.sName, TEXT("unittest"));
+  process.SetLogFile(sLogFilePath, false);
+  const string_t sCommand = process.GetCommandLine();
+
+  std::string sBuffer;
+  cResourceUsage usage;
+  admissionControl.Acquire(project.sName + TEXT(" ") + target.sName + TEXT(" unittest"), 0, 1);
+  NotifyStepStarted(project.sName, target.sName, TEXT("unittest"));
+  const int iReturnCode = process.Run(sBuffer, usage);
+  admissionControl.Release(0, 1);
+
+  if (iReturnCode == cChildProcess::iReturnCodeCancelled) {
+    // Another step failed with --fail-fast, this one is left as not run
+    NotifyStepFinished(project.sName, target.sName, TEXT("unittest"), false, usage);
+    return false;
+  }
+
+  // Report each test on its own, the log has the whole output, without a log we only have the end of it
+  std::vector<std::pair<string_t, bool> > tests;
+  if (!sLogFilePath.empty()) {
+    std::ifstream output(spitfire::string::ToUTF8(sLogFilePath).c_str());
+    ParseUnitTestResults(output, tests);
+  } else {
+    std::istringstream output(sBuffer);
+    ParseUnitTestResults(output, tests);
+  }
+
+  bool bIsTestFailed = false;
+  for (size_t i = 0; i < tests.size(); i++) {
+    const string_t sTestName = TEXT("unittest ") + tests[i].first;
+    if (tests[i].second) report.SetTestResultPassed(project.sName, target.sName, sTestName);
+    else {
+      report.SetTestResultFailed(project.sName, target.sName, sTestName);
+      bIsTestFailed = true;
+    }
+  }
+
+  const bool bPassed = ((iReturnCode == 0) && !bIsTestFailed);
+  report.SetTestResourceUsage(project.sName, target.sName, TEXT("unittest"), usage);
+  NotifyStepFinished(project.sName, target.sName, TEXT("unittest"), bPassed, usage);
+  if (!bPassed) {
+    ostringstream_t o;
+    o<<TEXT("cBuildManager::TestCPlusPlus Process \"")<<sCommand<<TEXT("\" ");
+    if (iReturnCode == cChildProcess::iReturnCodeTimedOut) o<<TEXT("timed out after ")<<(testTimeoutMS / 1000)<<TEXT(" seconds");
+    else o<<TEXT("returned ")<<iReturnCode;
+    o<<TEXT(", log=\"")<<sLogFilePath<<TEXT("\", sBuffer=\"")<<spitfire::string::ToString_t(sBuffer)<<TEXT("\"")<<std::endl;
+    SetError(o.str());
+    report.SetTestResultFailed(project.sName, target.sName, TEXT("unittest"));
+    return false;
+  } else {
+    #ifdef BUILD_DEBUG
+    LOG<<TEXT("cBuildManager::TestCPlusPlus Process \"")<<sCommand<<TEXT("\" returned ")<<iReturnCode<<TEXT(", sBuffer=\"")<<spitfire::string::ToString_t(sBuffer)<<TEXT("\"")<<std::endl;
+    #endif
+    report.SetTestResultPassed(project.sName, target.sName, TEXT("unittest"));
+  }
+
+  return true;
+}
+
+bool cBuildManager::Test(cReport& report, const cProject& project, const cTarget& target)
+{
+  if (IsJavaTarget(project, target)) return TestJava(report, project, target);
+
+  return TestCPlusPlus(report, project, target);
+}
+
+string_t cBuildManager::GetLogFilePath(const string_t& sProjectName, const string_t& sTargetName, const string_t& sStepName) const
+{
+  if (sLogFolder.empty()) return TEXT("");
+
+  string_t sFileName = GetSafeFileName(sProjectName);
+  if (!sTargetName.empty()) sFileName += TEXT("-") + GetSafeFileName(sTargetName);
+  sFileName += TEXT("-") + GetSafeFileName(sStepName) + TEXT(".log");
+
+  return spitfire::filesystem::MakeFilePath(sLogFolder, sFileName);
+}
+
+// Runs each command in turn, all writing to the same log file, stopping at the first one that fails
+int cBuildManager::RunCommands(const std::vector<cChildProcess>& commands, const string_t& sLogFilePath, string_t& sFailedCommand, std::string& sOutput, cResourceUsage& usage) const
+{
+  sFailedCommand.clear();
+  sOutput.clear();
+  usage = cResourceUsage();
+
+  const size_t n = commands.size();
+  for (size_t i = 0; i < n; i++) {
+    cChildProcess process = commands[i];
+    process.SetLogFile(sLogFilePath, (i != 0));
+
+    LOG<<TEXT("cBuildManager::RunCommands sCommand=\"")<<process.GetCommandLine()<<TEXT("\"")<<std::endl;
+
+    cResourceUsage commandUsage;
+    const int iReturnCode = process.Run(sOutput, commandUsage);
+    usage.Add(commandUsage);
+    if (iReturnCode != 0) {
+      sFailedCommand = process.GetCommandLine();
+      return iReturnCode;
+    }
+  }
+
+  return 0;
+}
+
+string_t cBuildManager::GetMirrorFolder(const string_t& sURL) const
+{
+  return spitfire::filesystem::MakeFilePath(sMirrorFolder, GetSafeFileName(sURL) + TEXT(".mirror"));
+}
+
+bool cBuildManager::UpdateMirror(const string_t& sURL, const string_t& sMirror)
+{
+  std::vector<cChildProcess> commands;
+  if (spitfire::filesystem::DirectoryExists(sMirror)) {
+    commands.resize(2);
+    commands[0].SetWorkingFolder(sMirror);
+    commands[0].AddArgument(TEXT("git"));
+    commands[0].AddArgument(TEXT("remote"));
+    commands[0].AddArgument(TEXT("set-url"));
+    commands[0].AddArgument(TEXT("origin"));
+    commands[0].AddArgument(sURL);
+    commands[1].SetWorkingFolder(sMirror);
+    commands[1].AddArgument(TEXT("git"));
+    commands[1].AddArgument(TEXT("fetch"));
+    commands[1].AddArgument(TEXT("--prune"));
+    commands[1].AddArgument(TEXT("origin"));
+  } else {
+    commands.resize(1);
+    commands[0].AddArgument(TEXT("git"));
+    commands[0].AddArgument(TEXT("clone"));
+    commands[0].AddArgument(TEXT("--mirror"));
+    commands[0].AddArgument(sURL);
+    commands[0].AddArgument(sMirror);
+  }
+
+  const string_t sLogFilePath = GetLogFilePath(GetSafeFileName(sURL), TEXT(""), TEXT("mirror"));
+
+  string_t sCommand;
+  std::string sBuffer;
+  cResourceUsage usage;
+  const int iReturnCode = RunCommands(commands, sLogFilePath, sCommand, sBuffer, usage);
+  if (iReturnCode != 0) {
+    // This isn't fatal, the projects using this url will just be cloned from the remote instead
+    LOGERROR<<TEXT("cBuildManager::UpdateMirror Process \"")<<sCommand<<TEXT("\" returned ")<<iReturnCode<<TEXT(", log=\"")<<sLogFilePath<<TEXT("\", sBuffer=\"")<<spitfire::string::ToString_t(sBuffer)<<TEXT("\"")<<std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+// Fetch each remote url that is about to be cloned once into its mirror, no matter how many projects use it
+void cBuildManager::UpdateMirrors(const std::vector<bool>& clone)
+{
+  mirrors.clear();
+
+  if (sMirrorFolder.empty()) return;
+
+  if (!spitfire::filesystem::DirectoryExists(sMirrorFolder) && !spitfire::filesystem::CreateDirectory(sMirrorFolder)) {
+    LOGERROR<<TEXT("cBuildManager::UpdateMirrors Mirror folder \"")<<sMirrorFolder<<TEXT("\" could not be created")<<std::endl;
+    return;
+  }
+
+  std::vector<string_t> urls;
+  const size_t nProjects = projects.size();
+  for (size_t i = 0; i < nProjects; i++) {
+    if (clone[i] && projects[i].IsProtocolGit() && (std::find(urls.begin(), urls.end(), projects[i].sURL) == urls.end())) urls.push_back(projects[i].sURL);
+  }
+
+  const size_t nURLs = urls.size();
+  std::vector<char> updated(nURLs, false);
+  ParallelFor(nCloneJobs, nURLs, [&](size_t i) { updated[i] = UpdateMirror(urls[i], GetMirrorFolder(urls[i])); });
+
+  for (size_t i = 0; i < nURLs; i++) {
+    if (updated[i]) mirrors[urls[i]] = GetMirrorFolder(urls[i]);
+  }
+}
+
+// Creates the ccache folder if it doesn't exist yet and caps its size, ccache evicts the least recently used results once it is full
+void cBuildManager::PrepareCompilerCache()
+{
+  bIsCompilerCacheValid = false;
+
+  if (sCompilerCacheFolder.empty()) return;
+
+  if (!spitfire::filesystem::DirectoryExists(sCompilerCacheFolder) && !spitfire::filesystem::CreateDirectory(sCompilerCacheFolder)) {
+    LOGERROR<<TEXT("cBuildManager::PrepareCompilerCache ccache folder \"")<<sCompilerCacheFolder<<TEXT("\" could not be created")<<std::endl;
+    return;
+  }
+
+  cChildProcess process;
+  process.AddArgument(TEXT("ccache"));
+  if (!sCompilerCacheMaxSize.empty()) {
+    process.AddArgument(TEXT("--max-size"));
+    process.AddArgument(sCompilerCacheMaxSize);
+  } else process.AddArgument(TEXT("--version"));
+  process.SetEnvironmentVariable(TEXT("CCACHE_DIR"), sCompilerCacheFolder);
+
+  std::string sBuffer;
+  const int iReturnCode = process.Run(sBuffer);
+  if (iReturnCode != 0) {
+    LOGERROR<<TEXT("cBuildManager::PrepareCompilerCache Process \"")<<process.GetCommandLine()<<TEXT("\" returned ")<<iReturnCode<<TEXT(", building without ccache, sBuffer=\"")<<spitfire::string::ToString_t(sBuffer)<<TEXT("\"")<<std::endl;
+    return;
+  }
+
+  bIsCompilerCacheValid = true;
+}
+
+// Every compiler that ccache runs for us shares the one cache
+// Paths under the working folder are hashed relative to it, so a fresh clone in a new temporary folder still hits what the previous run cached
+void cBuildManager::AddCompilerCacheToChildProcess(cChildProcess& process) const
+{
+  process.SetEnvironmentVariable(TEXT("CCACHE_DIR"), sCompilerCacheFolder);
+  process.SetEnvironmentVariable(TEXT("CCACHE_BASEDIR"), sWorkingFolder);
+  process.SetEnvironmentVariable(TEXT("CCACHE_NOHASHDIR"), TEXT("1"));
+}
+
+// Cloning is mostly waiting on the remote so we clone several projects at once, independently of the number of build jobs
+void cBuildManager::CloneProjects(cReport& report, const std::vector<bool>& clone, std::vector<bool>& cloneFailed)
+{
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  UpdateMirrors(clone);
+
+  std::vector<size_t> indices;
+  for (size_t i = 0; i < projects.size(); i++) {
+    if (clone[i]) indices.push_back(i);
+  }
+
+  // NOTE: std::vector<bool> packs its elements into shared words so each clone sets its own char rather than writing to cloneFailed directly
+  std::vector<char> failed(indices.size(), 0);
+  ParallelFor(nCloneJobs, indices.size(), [&](size_t i) { failed[i] = !Clone(report, projects[indices[i]]); });
+
+  cloneFailed.assign(projects.size(), false);
+  for (size_t i = 0; i < indices.size(); i++) cloneFailed[indices[i]] = (failed[i] != 0);
+
+  LOG<<TEXT("cBuildManager::CloneProjects Cloned ")<<indices.size()<<TEXT(" of ")<<projects.size()<<TEXT(" projects in ")<<GetElapsedMS(start)<<TEXT(" ms")<<std::endl;
+}
+
+// Every project that has changed is cloned, along with any of its dependencies, direct or indirect, that aren't already checked out
+// NOTE: An unchanged dependency in a persistent workspace is still checked out at the revision it last passed with, so it is left alone
+void cBuildManager::GetProjectsToClone(const std::vector<bool>& unchanged, std::vector<bool>& clone) const
+{
+  const size_t nProjects = projects.size();
+  clone.assign(nProjects, false);
+
+  std::vector<bool> needed(nProjects, false);
+  std::vector<size_t> allDependencies;
+  for (size_t i = 0; i < nProjects; i++) {
+    if (unchanged[i]) continue;
+
+    needed[i] = true;
+    graph.GetAllDependencies(i, allDependencies);
+    for (size_t j = 0; j < allDependencies.size(); j++) needed[allDependencies[j]] = true;
+  }
+
+  for (size_t i = 0; i < nProjects; i++) {
+    if (needed[i]) clone[i] = (!unchanged[i] || !spitfire::filesystem::DirectoryExists(spitfire::filesystem::MakeFilePath(sWorkingFolder, projects[i].sFolderName)));
+  }
+}
+
+// Builds each project as soon as all of its dependencies have built successfully, running up to nJobs targets at once
+// Each target's unit tests run as soon as it has built, up to nTestJobs at once on their own threads, so the tests overlap with building
+// the rest of the projects, dependents don't wait for the tests of their dependencies
+// Projects that are up to date are reported as cached and not built or tested again
+// As soon as a project fails, or couldn't be cloned, every project that depends on it is reported as skipped, projects that don't depend on it carry on
+// With fail-fast the first failure also kills every step that is running and nothing else is started
+void cBuildManager::BuildProjectsInDependencyOrder(cReport& report, const std::vector<bool>& upToDate, const std::vector<bool>& cloneFailed, std::vector<bool>& succeeded)
+{
+  const size_t nProjects = projects.size();
+
+  // Count the dependencies that each project is waiting on
+  std::vector<size_t> dependenciesRemaining(nProjects, 0);
+  std::vector<size_t> targetsRemaining(nProjects, 0);
+  std::vector<size_t> testsRemaining(nProjects, 0);
+  std::vector<bool> failed(nProjects, false);
+  std::vector<bool> testsFailed(nProjects, false);
+  std::vector<bool> finished(nProjects, false);
+  std::vector<bool> blocked(nProjects, false);
+  for (size_t i = 0; i < nProjects; i++) {
+    dependenciesRemaining[i] = graph.GetDependencies(i).size();
+    targetsRemaining[i] = projects[i].targets.size();
+  }
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::list<std::pair<size_t, size_t> > ready; // Project and target indices that can be built right now
+  std::list<std::pair<size_t, size_t> > readyToTest; // Project and target indices that have built and can be tested right now
+  size_t nRunning = 0;
+  bool bIsBuilding = true;
+
+  bIsCancelled = false;
+
+  // NOTE: These are only called with mutex locked
+  std::function<void (size_t)> MakeReady;
+  // Observers only hear about a project once its tests have finished too
+  std::function<void (size_t)> NotifyProjectFinished = [&](size_t iProject)
+  {
+    if (observers.empty()) return;
+
+    const cReportProject* pProject = report.GetProject(projects[iProject].sName);
+    if (pProject != nullptr) {
+      for (size_t k = 0; k < observers.size(); k++) observers[k]->OnProjectFinished(*pProject);
+    }
+  };
+  std::function<void (size_t)> Block = [&](size_t iProject)
+  {
+    const std::vector<size_t>& dependents = graph.GetDependents(iProject);
+    for (size_t j = 0; j < dependents.size(); j++) {
+      const size_t iDependent = dependents[j];
+      if (blocked[iDependent]) continue;
+
+      blocked[iDependent] = true;
+
+      const cProject& project = projects[iDependent];
+      LOGERROR<<TEXT("Project \"")<<project.sName<<TEXT("\" skipped: dependency \"")<<projects[iProject].sName<<TEXT("\" failed")<<std::endl;
+      const size_t nTargets = project.targets.size();
+      for (size_t iTarget = 0; iTarget < nTargets; iTarget++) {
+        const cTarget& target = project.targets[iTarget];
+        const std::vector<string_t> steps = GetStepNames(project, target);
+        for (size_t iStep = 0; iStep < steps.size(); iStep++) report.SetTestResultSkipped(project.sName, target.sName, steps[iStep]);
+      }
+
+      for (size_t k = 0; k < observers.size(); k++) observers[k]->OnProjectBlocked(project.sName, projects[iProject].sName);
+      NotifyProjectFinished(iDependent);
+      Block(iDependent);
+    }
+  };
+  // Kills the steps that are running and forgets everything that is waiting to run
+  auto Cancel = [&]()
+  {
+    if (bIsCancelled) return;
+
+    LOGERROR<<TEXT("cBuildManager::BuildProjectsInDependencyOrder Stopping the build because a step failed and fail-fast is on")<<std::endl;
+    bIsCancelled = true;
+    ready.clear();
+
+    // Killing a make loses the tokens that its sub makes had taken, so fill the pool back up, otherwise a step that is waiting for a token
+    // could wait forever, once it has its token it sees that the build was cancelled and gives it back without running
+    if (jobServer.IsValid()) jobServer.ReleaseTokens(jobServer.GetTokens());
+
+    for (std::list<std::pair<size_t, size_t> >::const_iterator iter = readyToTest.begin(); iter != readyToTest.end(); iter++) {
+      assert(testsRemaining[iter->first] != 0);
+      testsRemaining[iter->first]--;
+      testsFailed[iter->first] = true;
+      if ((testsRemaining[iter->first] == 0) && finished[iter->first]) NotifyProjectFinished(iter->first);
+    }
+    readyToTest.clear();
+  };
+  std::function<void (size_t)> Finish = [&](size_t iProject)
+  {
+    finished[iProject] = true;
+
+    if (testsRemaining[iProject] == 0) NotifyProjectFinished(iProject);
+
+    if (failed[iProject]) {
+      Block(iProject);
+      return;
+    }
+
+    const std::vector<size_t>& dependents = graph.GetDependents(iProject);
+    for (size_t j = 0; j < dependents.size(); j++) {
+      const size_t iDependent = dependents[j];
+      assert(dependenciesRemaining[iDependent] != 0);
+      dependenciesRemaining[iDependent]--;
+      if (dependenciesRemaining[iDependent] == 0) MakeReady(iDependent);
+    }
+  };
+  MakeReady = [&](size_t iProject)
+  {
+    if (bIsCancelled) return;
+
+    // A project that couldn't be cloned fails without building anything, so that only its dependents are skipped
+    if (cloneFailed[iProject]) {
+      const cProject& project = projects[iProject];
+      LOGERROR<<TEXT("Project \"")<<project.sName<<TEXT("\" skipped: clone failed")<<std::endl;
+      const size_t nTargets = project.targets.size();
+      for (size_t iTarget = 0; iTarget < nTargets; iTarget++) {
+        const cTarget& target = project.targets[iTarget];
+        const std::vector<string_t> steps = GetStepNames(project, target);
+        for (size_t iStep = 0; iStep < steps.size(); iStep++) report.SetTestResultSkipped(project.sName, target.sName, steps[iStep]);
+      }
+      failed[iProject] = true;
+      if (bFailFast) Cancel();
+      Finish(iProject);
+      return;
+    }
+
+    if (upToDate[iProject]) {
+      const cProject& project = projects[iProject];
+      LOG<<TEXT("cBuildManager::BuildProjectsInDependencyOrder Project \"")<<project.sName<<TEXT("\" is up to date")<<std::endl;
+      const size_t nTargets = project.targets.size();
+      for (size_t iTarget = 0; iTarget < nTargets; iTarget++) {
+        const cTarget& target = project.targets[iTarget];
+        const std::vector<string_t> steps = GetStepNames(project, target);
+        for (size_t iStep = 0; iStep < steps.size(); iStep++) report.SetTestResultCachedPassed(project.sName, target.sName, steps[iStep]);
+      }
+      Finish(iProject);
+      return;
+    }
+
+    // A project without targets (A library for example) is finished as soon as it is ready
+    if (targetsRemaining[iProject] == 0) {
+      Finish(iProject);
+      return;
+    }
+
+    for (size_t k = 0; k < observers.size(); k++) observers[k]->OnProjectReady(projects[iProject].sName);
+
+    const size_t nTargets = projects[iProject].targets.size();
+    for (size_t iTarget = 0; iTarget < nTargets; iTarget++) ready.push_back(std::make_pair(iProject, iTarget));
+  };
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    const std::vector<size_t>& order = graph.GetTopologicalOrder();
+    for (size_t k = 0; (k < order.size()) && (graph.GetLevel(order[k]) == 0); k++) MakeReady(order[k]);
+  }
+
+  auto Worker = [&]()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      // Wait until there is something to build, or until nothing is running that could make anything else ready
+      condition.wait(lock, [&]() { return (!ready.empty() || (nRunning == 0)); });
+      if (ready.empty()) break;
+
+      const std::pair<size_t, size_t> job = ready.front();
+      ready.pop_front();
+      nRunning++;
+
+      lock.unlock();
+      const cProject& project = projects[job.first];
+      const bool bSucceeded = Build(report, project, project.targets[job.second]);
+      lock.lock();
+
+      nRunning--;
+      if (!bSucceeded && bIsCancelled) {
+        // Stopped by fail-fast, the project is left unfinished rather than failed so that its dependents aren't reported as skipped
+        condition.notify_all();
+        continue;
+      }
+
+      if (!bSucceeded) {
+        failed[job.first] = true;
+        if (bFailFast) Cancel();
+      } else if (!bIsCancelled) {
+        readyToTest.push_back(job);
+        testsRemaining[job.first]++;
+      }
+      assert(targetsRemaining[job.first] != 0);
+      targetsRemaining[job.first]--;
+      if (targetsRemaining[job.first] == 0) Finish(job.first);
+
+      condition.notify_all();
+    }
+  };
+
+  auto TestWorker = [&]()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      // Wait until there is something to test, or until every build has finished
+      condition.wait(lock, [&]() { return (!readyToTest.empty() || !bIsBuilding); });
+      if (readyToTest.empty()) break;
+
+      const std::pair<size_t, size_t> job = readyToTest.front();
+      readyToTest.pop_front();
+
+      lock.unlock();
+      const cProject& project = projects[job.first];
+      const bool bPassed = Test(report, project, project.targets[job.second]);
+      lock.lock();
+
+      if (!bPassed) {
+        testsFailed[job.first] = true;
+        if (bFailFast) Cancel();
+      }
+      assert(testsRemaining[job.first] != 0);
+      testsRemaining[job.first]--;
+      if ((testsRemaining[job.first] == 0) && finished[job.first]) NotifyProjectFinished(job.first);
+    }
+  };
+
+  LOG<<TEXT("cBuildManager::BuildProjectsInDependencyOrder Building with ")<<nJobs<<TEXT(" jobs and testing with ")<<nTestJobs<<TEXT(" jobs")<<std::endl;
+
+  std::vector<std::thread> testWorkers;
+  for (size_t i = 0; i < nTestJobs; i++) testWorkers.push_back(std::thread(TestWorker));
+
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < nJobs; i++) workers.push_back(std::thread(Worker));
+  for (size_t i = 0; i < nJobs; i++) workers[i].join();
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    bIsBuilding = false;
+    condition.notify_all();
+  }
+
+  for (size_t i = 0; i < nTestJobs; i++) testWorkers[i].join();
+
+  for (size_t i = 0; i < nProjects; i++) {
+    if (!finished[i] && !blocked[i]) LOGERROR<<TEXT("Project \"")<<projects[i].sName<<TEXT("\" was not built because the build was stopped")<<std::endl;
+    else if (testsFailed[i]) LOGERROR<<TEXT("Project \"")<<projects[i].sName<<TEXT("\" built but its unit tests failed")<<std::endl;
+    succeeded[i] = (finished[i] && !failed[i] && !testsFailed[i]);
+  }
+}
+
+void cBuildManager::ListAllProjects(cReport& report)
+{
+  LoadFromXMLFile();
+  if (IsError()) return;
+
+  SelectProjects();
+  if (IsError()) return;
+
+  if (projects.empty()) {
+    SetError(TEXT("No projects found"));
+    return;
+  }
+
+  const size_t n = projects.size();
+  for (size_t i = 0; i < n; i++) {
+    const cProject& project = projects[i];
+    std::cout<<spitfire::string::ToUTF8(project.sName)<<'\n';
+
+    const size_t nTargets = project.targets.size();
+    for (size_t j = 0; j < nTargets; j++) {
+      const cTarget& target = project.targets[j];
+      std::cout<<spitfire::string::ToUTF8(target.sName)<<'\n';
+    }
+  }
+  std::cout.flush();
+}
+
+bool cBuildManager::LoadProjects()
+{
+  bIsLoaded = false;
+
+  LoadFromXMLFile();
+  if (IsError()) return false;
+
+  SelectProjects();
+  if (IsError()) return false;
+
+  if (projects.empty()) {
+    SetError(TEXT("No projects found"));
+    return false;
+  }
+
+  const size_t nProjects = projects.size();
+
+  LOG<<"Checking prerequisites for projects"<<std::endl;
+  cReport report;
+  bool bPrerequisitesFailed = false;
+  std::map<string_t, bool> installedTools;
+  for (size_t i = 0; i < nProjects; i++) {
+    const cProject& project = projects[i];
+    if (!CheckPrerequisites(report, project, installedTools)) bPrerequisitesFailed = true;
+  }
+
+  if (bPrerequisitesFailed) {
+    SetError(TEXT("Prerequisites failed"));
+    return false;
+  }
+
+  // C++ targets are generated for ninja if it is installed and can share our jobserver (ninja 1.13 or later), otherwise they fall back to make
+  {
+    cChildProcess process;
+    process.AddArgument(TEXT("ninja"));
+    process.AddArgument(TEXT("--version"));
+    std::string sBuffer;
+    bIsNinjaInstalled = (process.Run(sBuffer) == 0);
+
+    unsigned int major = 0;
+    unsigned int minor = 0;
+    char separator = 0;
+    std::istringstream version(sBuffer);
+    version>>major>>separator>>minor;
+    bIsNinjaJobServerClient = (bIsNinjaInstalled && ((major > 1) || ((major == 1) && (minor >= 13))));
+
+    if (!bIsNinjaInstalled && (sGenerator == TEXT("ninja"))) LOGERROR<<TEXT("cBuildManager::LoadProjects ninja is not installed, building with make instead")<<std::endl;
+    else if (bIsNinjaInstalled && !bIsNinjaJobServerClient && sGenerator.empty()) LOG<<TEXT("cBuildManager::LoadProjects ninja ")<<spitfire::string::ToString_t(sBuffer.substr(0, sBuffer.find('\n')))<<TEXT(" can't share the jobserver, building with make unless ninja is asked for")<<std::endl;
+  }
+
+  bIsLoaded = true;
+  return true;
+}
+
+// Writes the dependency graph as a Graphviz dot file, for example "dot -Tsvg buildall.dot -o buildall.svg"
+void cBuildManager::WriteGraph(const string_t& sFilePath)
+{
+  LoadFromXMLFile();
+  if (projects.empty()) return;
+
+  // A graph with a cycle is still written so that the cycle can be seen
+  if (graph.GetCycle().empty()) {
+    SelectProjects();
+    if (IsError()) return;
+  }
+
+  std::ofstream file(spitfire::string::ToUTF8(sFilePath).c_str(), std::ios::out | std::ios::trunc);
+  graph.WriteDOT(file, projects);
+  if (!file.good()) SetError(TEXT("Failed to write \"") + sFilePath + TEXT("\""));
+}
+
+void cBuildManager::BuildAllProjects(cReport& report, const std::vector<string_t>& _remoteRevisions)
+{
+  if (!bIsLoaded && !LoadProjects()) return;
+
+  // Errors from a previous build don't carry over to this one
+  ClearError();
+
+  runStart = std::chrono::steady_clock::now();
+  {
+    std::lock_guard<std::mutex> lock(mutexStepTimings);
+    stepTimings.clear();
+  }
+
+  const size_t nProjects = projects.size();
+
+  // Add an entry for each project to the report
+  for (size_t i = 0; i < nProjects; i++) {
+    const cProject& project = projects[i];
+    report.AddProject(project.sName);
+    report.AddTest(project.sName, TEXT("clone"));
+  }
+
+  // Either update the checkouts in our persistent workspace or start from scratch in a temporary folder
+  std::unique_ptr<spitfire::filesystem::cScopedTemporaryFolder> pTemporaryFolder;
+  if (sWorkspaceFolder.empty()) {
+    pTemporaryFolder.reset(new spitfire::filesystem::cScopedTemporaryFolder);
+    sWorkingFolder = pTemporaryFolder->GetFolder();
+  } else {
+    if (!spitfire::filesystem::DirectoryExists(sWorkspaceFolder) && !spitfire::filesystem::CreateDirectory(sWorkspaceFolder)) {
+      SetError(TEXT("Workspace folder \"") + sWorkspaceFolder + TEXT("\" could not be created"));
+      return;
+    }
+    sWorkingFolder = sWorkspaceFolder;
+  }
+
+  LOG<<TEXT("cBuildManager::BuildAllProjects Working folder \"")<<sWorkingFolder<<TEXT("\"")<<std::endl;
+
+  if (!sLogFolder.empty() && !spitfire::filesystem::DirectoryExists(sLogFolder) && !spitfire::filesystem::CreateDirectory(sLogFolder)) {
+    LOGERROR<<TEXT("cBuildManager::BuildAllProjects Log folder \"")<<sLogFolder<<TEXT("\" could not be created, step output will not be logged")<<std::endl;
+    sLogFolder.clear();
+  }
+
+  std::map<string_t, string_t> fingerprints;
+  LoadFingerprints(fingerprints);
+
+  // Ask every remote for its current revision before cloning anything, a project where neither it nor any of its dependencies have moved
+  // since it last passed doesn't need to be cloned, built or tested at all
+  // NOTE: The daemon has just asked the remotes when it decides to build, so it passes us the revisions it got back
+  std::vector<string_t> remoteRevisions(_remoteRevisions);
+  if (remoteRevisions.size() != nProjects) {
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    GetRemoteRevisions(remoteRevisions);
+    LOG<<TEXT("cBuildManager::BuildAllProjects Checked the remote revisions of ")<<nProjects<<TEXT(" projects in ")<<GetElapsedMS(start)<<TEXT(" ms")<<std::endl;
+  }
+
+  std::vector<string_t> unselectedRevisions;
+  GetUnselectedRevisions(unselectedRevisions);
+
+  std::vector<bool> unchanged(nProjects, false);
+  if (bUseFingerprints) {
+    for (size_t i = 0; i < nProjects; i++) {
+      const string_t sFingerprint = GetFingerprint(i, remoteRevisions, unselectedRevisions);
+      std::map<string_t, string_t>::const_iterator iter = fingerprints.find(projects[i].sName);
+      unchanged[i] = (!sFingerprint.empty() && (iter != fingerprints.end()) && (iter->second == sFingerprint));
+    }
+  }
+
+  std::vector<bool> clone;
+  GetProjectsToClone(unchanged, clone);
+
+  for (size_t i = 0; i < nProjects; i++) {
+    if (!clone[i]) report.SetTestResultCachedPassed(projects[i].sName, TEXT("clone"));
+  }
+
+  // A project that is cloned into a new folder has no build tree, even if it is unchanged it has to be built again before its dependents can build
+  std::vector<bool> freshlyCloned(nProjects, false);
+  for (size_t i = 0; i < nProjects; i++) {
+    if (clone[i]) freshlyCloned[i] = !spitfire::filesystem::DirectoryExists(spitfire::filesystem::MakeFilePath(sWorkingFolder, projects[i].sFolderName));
+  }
+
+  // Pull the projects that have changed
+  LOG<<TEXT("Cloning Projects")<<std::endl;
+  std::vector<bool> cloneFailed;
+  CloneProjects(report, clone, cloneFailed);
+
+  // Add an entry for each project to the report
+  for (size_t i = 0; i < nProjects; i++) {
+    const cProject& project = projects[i];
+
+    const size_t nTargets = project.targets.size();
+    for (size_t iTarget = 0; iTarget < nTargets; iTarget++) {
+      const cTarget& target = project.targets[iTarget];
+      const std::vector<string_t> steps = GetStepNames(project, target);
+      for (size_t iStep = 0; iStep < steps.size(); iStep++) report.AddTest(project.sName, target.sName, steps[iStep]);
+    }
+  }
+
+  // Find out what we actually checked out and skip the projects where neither they nor their dependencies have changed since they last passed
+  // A project that failed to clone is reported as failed when the build reaches it, its dependents are skipped and everything else still builds
+  std::vector<string_t> revisions(remoteRevisions);
+  ParallelFor(nCloneJobs, nProjects, [&](size_t i) { if (clone[i]) revisions[i] = cloneFailed[i] ? TEXT("") : GetRevision(projects[i]); });
+
+  std::vector<string_t> currentFingerprints(nProjects);
+  std::vector<bool> upToDate(nProjects, false);
+  for (size_t i = 0; i < nProjects; i++) {
+    currentFingerprints[i] = GetFingerprint(i, revisions, unselectedRevisions);
+    if (bUseFingerprints && !currentFingerprints[i].empty()) {
+      std::map<string_t, string_t>::const_iterator iter = fingerprints.find(projects[i].sName);
+      upToDate[i] = ((iter != fingerprints.end()) && (iter->second == currentFingerprints[i]));
+    }
+  }
+
+  // Visiting dependents before dependencies, a freshly cloned project is built whenever any of its dependents is, whatever its fingerprint says
+  {
+    const std::vector<size_t>& order = graph.GetTopologicalOrder();
+    for (size_t k = order.size(); k > 0; k--) {
+      const size_t i = order[k - 1];
+      if (!upToDate[i] || !freshlyCloned[i]) continue;
+
+      const std::vector<size_t>& dependents = graph.GetDependents(i);
+      for (size_t j = 0; j < dependents.size(); j++) {
+        if (!upToDate[dependents[j]]) {
+          upToDate[i] = false;
+          break;
+        }
+      }
+    }
+  }
+
+  LOG<<TEXT("Building and Testing Projects")<<std::endl;
+  PrepareCompilerCache();
+
+  // Compile and test all projects
+  if (!jobServer.Create(nCompileJobs)) LOGERROR<<TEXT("cBuildManager::BuildAllProjects Failed to create the jobserver, make will build one job at a time")<<std::endl;
+
+  std::vector<bool> succeeded(nProjects, false);
+  BuildProjectsInDependencyOrder(report, upToDate, cloneFailed, succeeded);
+
+  jobServer.Destroy();
+
+  // Remember which projects passed so that we can skip them next time if nothing changes
+  // NOTE: A project where only some of the targets were selected has only partly passed, so it is left as it was
+  for (size_t i = 0; i < nProjects; i++) {
+    const bool bAllTargets = (allProjects.empty() || (projects[i].targets.size() == allProjects[allProjectIndices[i]].targets.size()));
+    if (succeeded[i] && !currentFingerprints[i].empty()) {
+      if (bAllTargets) fingerprints[projects[i].sName] = currentFingerprints[i];
+    } else fingerprints.erase(projects[i].sName);
+  }
+
+  SaveFingerprints(fingerprints);
+
+  AnalyseCriticalPath(report);
+}
+
+// Work out which chain of projects determined how long the run took, using when each step actually started and finished
+// Every clone finishes before any build starts, so the clone phase is charged once, from the first clone starting to the last one finishing
+// A project's build runs from its first build step starting to its last one finishing, dependents only wait for the build steps so unit tests
+// are a branch off the end of a project rather than part of the chain, the critical path walks back from the project that finished last,
+// through the dependency whose build finished last, until it reaches a project that was only waiting for the clone phase
+// Slack is how much longer a project could have taken without making the run any longer
+void cBuildManager::AnalyseCriticalPath(cReport& report) const
+{
+  const size_t nProjects = projects.size();
+  if (nProjects == 0) return;
+
+  std::map<string_t, std::vector<cStepTiming> > timings;
+  {
+    std::lock_guard<std::mutex> lock(mutexStepTimings);
+    timings = stepTimings;
+  }
+
+  const size_t NONE = size_t(-1);
+
+  bool bIsCloned = false;
+  uint64_t cloneStartMS = 0;
+  uint64_t cloneFinishMS = 0;
+  size_t iLastClone = NONE;
+
+  bool bIsBuilt = false;
+  uint64_t buildStartMS = 0;
+
+  std::vector<bool> hasSteps(nProjects, false);
+  std::vector<uint64_t> startMS(nProjects, 0);
+  std::vector<uint64_t> finishMS(nProjects, 0);
+  std::vector<std::vector<cCriticalPathStep> > steps(nProjects); // The build steps of the target that finished building last
+  std::vector<uint64_t> testFinishMS(nProjects, 0);
+  std::vector<cCriticalPathStep> testSteps(nProjects); // The unit tests that finished last
+  for (size_t i = 0; i < nProjects; i++) {
+    std::map<string_t, std::vector<cStepTiming> >::const_iterator iter = timings.find(projects[i].sName);
+    if (iter == timings.end()) continue;
+
+    string_t sLastTarget;
+    const std::vector<cStepTiming>& projectTimings = iter->second;
+    for (size_t iTiming = 0; iTiming < projectTimings.size(); iTiming++) {
+      const cStepTiming& timing = projectTimings[iTiming];
+      if (!timing.bIsFinished) continue;
+
+      if (timing.sTarget.empty()) {
+        if (!bIsCloned || (timing.startMS < cloneStartMS)) cloneStartMS = timing.startMS;
+        if (!bIsCloned || (timing.finishMS > cloneFinishMS)) {
+          cloneFinishMS = timing.finishMS;
+          iLastClone = i;
+        }
+        bIsCloned = true;
+        continue;
+      }
+
+      if (timing.sStep == TEXT("unittest")) {
+        if (testSteps[i].sStep.empty() || (timing.finishMS >= testFinishMS[i])) {
+          testFinishMS[i] = timing.finishMS;
+          testSteps[i].sProject = projects[i].sName;
+          testSteps[i].sTarget = timing.sTarget;
+          testSteps[i].sStep = timing.sStep;
+          testSteps[i].durationMS = timing.finishMS - timing.startMS;
+        }
+        continue;
+      }
+
+      if (!bIsBuilt || (timing.startMS < buildStartMS)) buildStartMS = timing.startMS;
+      bIsBuilt = true;
+
+      if (!hasSteps[i] || (timing.startMS < startMS[i])) startMS[i] = timing.startMS;
+      if (!hasSteps[i] || (timing.finishMS >= finishMS[i])) {
+        finishMS[i] = timing.finishMS;
+        sLastTarget = timing.sTarget;
+      }
+      hasSteps[i] = true;
+    }
+
+    for (size_t iTiming = 0; iTiming < projectTimings.size(); iTiming++) {
+      const cStepTiming& timing = projectTimings[iTiming];
+      if (!timing.bIsFinished || timing.sTarget.empty() || (timing.sTarget != sLastTarget) || (timing.sStep == TEXT("unittest"))) continue;
+
+      cCriticalPathStep step;
+      step.sProject = projects[i].sName;
+      step.sTarget = timing.sTarget;
+      step.sStep = timing.sStep;
+      step.durationMS = timing.finishMS - timing.startMS;
+      steps[i].push_back(step);
+    }
+  }
+
+  // The run starts with the first clone, or with the first build if nothing had to be cloned
+  const uint64_t runStartMS = bIsCloned ? cloneStartMS : (bIsBuilt ? buildStartMS : 0);
+  if (!bIsCloned) cloneFinishMS = runStartMS;
+
+  // A project that wasn't built finishes as soon as the clone phase and all of its dependencies have, each project waited on the
+  // dependency that finished last, or on the clone phase if that finished after all of its dependencies
+  std::vector<uint64_t> durationMS(nProjects, 0);
+  std::vector<size_t> latestDependency(nProjects, NONE);
+  const std::vector<size_t>& order = graph.GetTopologicalOrder();
+  for (size_t k = 0; k < order.size(); k++) {
+    const size_t i = order[k];
+
+    uint64_t readyMS = cloneFinishMS;
+    const std::vector<size_t>& dependencies = graph.GetDependencies(i);
+    for (size_t j = 0; j < dependencies.size(); j++) {
+      const size_t iDependency = dependencies[j];
+      if (finishMS[iDependency] > readyMS) {
+        readyMS = finishMS[iDependency];
+        latestDependency[i] = iDependency;
+      }
+    }
+
+    if (hasSteps[i]) durationMS[i] = finishMS[i] - startMS[i];
+    else finishMS[i] = readyMS;
+  }
+
+  // The unit tests of a project can finish after its build, which is how long its tests held up the end of the run
+  std::vector<uint64_t> testTailMS(nProjects, 0);
+  for (size_t i = 0; i < nProjects; i++) {
+    if (testFinishMS[i] > finishMS[i]) testTailMS[i] = testFinishMS[i] - finishMS[i];
+  }
+
+  size_t iLast = 0;
+  for (size_t i = 0; i < nProjects; i++) {
+    if ((finishMS[i] + testTailMS[i]) > (finishMS[iLast] + testTailMS[iLast])) iLast = i;
+  }
+  const uint64_t runFinishMS = std::max(finishMS[iLast] + testTailMS[iLast], cloneFinishMS);
+  const uint64_t totalMS = runFinishMS - runStartMS;
+
+  // Latest build finish of each project that wouldn't delay its own tests or any of its dependents, visiting dependents before dependencies
+  std::vector<uint64_t> latestFinishMS(nProjects, runFinishMS);
+  for (size_t i = 0; i < nProjects; i++) latestFinishMS[i] -= std::min(runFinishMS, testTailMS[i]);
+  for (size_t k = order.size(); k > 0; k--) {
+    const size_t i = order[k - 1];
+    const uint64_t latestStartMS = latestFinishMS[i] - std::min(latestFinishMS[i], durationMS[i]);
+    const std::vector<size_t>& dependencies = graph.GetDependencies(i);
+    for (size_t j = 0; j < dependencies.size(); j++) {
+      const size_t iDependency = dependencies[j];
+      latestFinishMS[iDependency] = std::min(latestFinishMS[iDependency], latestStartMS);
+    }
+  }
+
+  std::vector<bool> isOnCriticalPath(nProjects, false);
+  std::vector<size_t> chain;
+  for (size_t i = iLast; i != NONE; i = latestDependency[i]) {
+    isOnCriticalPath[i] = true;
+    chain.push_back(i);
+  }
+  std::reverse(chain.begin(), chain.end());
+
+  std::vector<cCriticalPathStep> criticalPath;
+  if (bIsCloned) {
+    cCriticalPathStep step;
+    step.sProject = projects[iLastClone].sName;
+    step.sStep = TEXT("clone");
+    step.durationMS = cloneFinishMS - cloneStartMS;
+    criticalPath.push_back(step);
+  }
+  for (size_t k = 0; k < chain.size(); k++) criticalPath.insert(criticalPath.end(), steps[chain[k]].begin(), steps[chain[k]].end());
+  if (testTailMS[iLast] != 0) criticalPath.push_back(testSteps[iLast]);
+  report.SetCriticalPath(criticalPath, totalMS);
+
+  LOG<<TEXT("Critical path ")<<totalMS<<TEXT("ms:")<<std::endl;
+  for (size_t k = 0; k < criticalPath.size(); k++) {
+    const cCriticalPathStep& step = criticalPath[k];
+    LOG<<TEXT("  ")<<step.sProject<<TEXT(" ")<<step.sTarget<<(step.sTarget.empty() ? TEXT("") : TEXT(" "))<<step.sStep<<TEXT(" ")<<step.durationMS<<TEXT("ms")<<std::endl;
+  }
+
+  LOG<<TEXT("Slack:")<<std::endl;
+  for (size_t i = 0; i < nProjects; i++) {
+    const uint64_t slackMS = latestFinishMS[i] - std::min(latestFinishMS[i], finishMS[i]);
+    report.SetCriticalPathAnalysis(projects[i].sName, isOnCriticalPath[i], slackMS);
+    if (!isOnCriticalPath[i]) LOG<<TEXT("  ")<<projects[i].sName<<TEXT(" ")<<slackMS<<TEXT("ms")<<std::endl;
+  }
+}
+
+string_t cBuildManager::GetRevision(const cProject& project) const
+{
+  const string_t sProjectFolder = spitfire::filesystem::MakeFilePath(sWorkingFolder, project.sFolderName);
+
+  cChildProcess process;
+  process.SetWorkingFolder(sProjectFolder);
+  if (project.IsProtocolGit()) {
+    process.AddArgument(TEXT("git"));
+    process.AddArgument(TEXT("rev-parse"));
+    process.AddArgument(TEXT("HEAD"));
+  } else {
+    process.AddArgument(TEXT("svn"));
+    process.AddArgument(TEXT("info"));
+    process.AddArgument(TEXT("--show-item"));
+    process.AddArgument(TEXT("last-changed-revision"));
+  }
+  const string_t sCommand = process.GetCommandLine();
+
+  std::string sBuffer;
+  const int iReturnCode = process.Run(sBuffer);
+  if (iReturnCode != 0) {
+    LOGERROR<<TEXT("cBuildManager::GetRevision Process \"")<<sCommand<<TEXT("\" returned ")<<iReturnCode<<TEXT(", sBuffer=\"")<<spitfire::string::ToString_t(sBuffer)<<TEXT("\"")<<std::endl;
+    return TEXT("");
+  }
+
+  // Remove the trailing new line
+  while (!sBuffer.empty() && isspace(sBuffer[sBuffer.length() - 1])) sBuffer.erase(sBuffer.length() - 1);
+
+  return spitfire::string::ToString_t(sBuffer);
+}
+
+string_t cBuildManager::GetRemoteRevision(const cProject& project) const
+{
+  // Only the revision is transferred, this is the same revision that GetRevision will return once the project has been cloned
+  cChildProcess process;
+  if (project.IsProtocolGit()) {
+    process.AddArgument(TEXT("git"));
+    process.AddArgument(TEXT("ls-remote"));
+    process.AddArgument(project.sURL);
+    process.AddArgument(TEXT("HEAD"));
+  } else {
+    process.AddArgument(TEXT("svn"));
+    process.AddArgument(TEXT("info"));
+    process.AddArgument(TEXT("--show-item"));
+    process.AddArgument(TEXT("last-changed-revision"));
+    process.AddArgument(project.sURL);
+  }
+  const string_t sCommand = process.GetCommandLine();
+
+  std::string sBuffer;
+  const int iReturnCode = process.Run(sBuffer);
+  if (iReturnCode != 0) {
+    LOGERROR<<TEXT("cBuildManager::GetRemoteRevision Process \"")<<sCommand<<TEXT("\" returned ")<<iReturnCode<<TEXT(", sBuffer=\"")<<spitfire::string::ToString_t(sBuffer)<<TEXT("\"")<<std::endl;
+    return TEXT("");
+  }
+
+  // git ls-remote prints "<revision><tab>HEAD", svn info just prints the revision
+  const size_t end = sBuffer.find_first_of(" \t\r\n");
+  if (end != std::string::npos) sBuffer.erase(end);
+
+  return spitfire::string::ToString_t(sBuffer);
+}
+
+void cBuildManager::GetRemoteRevisions(std::vector<string_t>& revisions) const
+{
+  revisions.assign(projects.size(), TEXT(""));
+  ParallelFor(nCloneJobs, projects.size(), [&](size_t i) { revisions[i] = GetRemoteRevision(projects[i]); });
+}
+
+// Dependencies that weren't selected aren't cloned or built, the selected projects build against whatever is checked out in the working
+// folder, so that is the revision that they are fingerprinted with
+// unselectedRevisions is indexed like allProjects and only has the revisions of unselected projects that a selected project depends on
+void cBuildManager::GetUnselectedRevisions(std::vector<string_t>& unselectedRevisions) const
+{
+  unselectedRevisions.assign(allProjects.size(), TEXT(""));
+  if (allProjects.empty()) return;
+
+  std::vector<bool> needed(allProjects.size(), false);
+  std::vector<size_t> allDependencies;
+  for (size_t i = 0; i < allProjectIndices.size(); i++) {
+    allGraph.GetAllDependencies(allProjectIndices[i], allDependencies);
+    for (size_t j = 0; j < allDependencies.size(); j++) needed[allDependencies[j]] = true;
+  }
+  for (size_t i = 0; i < allProjectIndices.size(); i++) needed[allProjectIndices[i]] = false;
+
+  std::vector<size_t> indices;
+  for (size_t i = 0; i < allProjects.size(); i++) {
+    if (needed[i] && spitfire::filesystem::DirectoryExists(spitfire::filesystem::MakeFilePath(sWorkingFolder, allProjects[i].sFolderName))) indices.push_back(i);
+  }
 
-  std::vector<cProject*> dependencies;
-};
+  ParallelFor(nCloneJobs, indices.size(), [&](size_t i) { unselectedRevisions[indices[i]] = GetRevision(allProjects[indices[i]]); });
+}
 
-void cProject::BuildDepencenciesGraph(std::vector<cProject>& allProjects)
+// The fingerprint of a project is the revision of the project and of every project that it depends on, directly or indirectly, so a change
+// to a library changes the fingerprint of everything that uses it
+// With a selection the dependencies come from every project in the config, so the fingerprint is the same as it would be for a full run
+// NOTE: Returns an empty string if any of the revisions are unknown
+string_t cBuildManager::GetFingerprint(size_t iProject, const std::vector<string_t>& revisions, const std::vector<string_t>& unselectedRevisions) const
 {
-  const size_t n = dependenciesAsString.size();
-  for (size_t i = 0; i < n; i++) {
-    const string_t sNameToFind = dependenciesAsString[i];
-    bool bFound = false;
-
-    const size_t nProjects = allProjects.size();
-    for (size_t j = 0; j < nProjects; j++) {
-      if (sNameToFind == allProjects[j].sName) {
-        cProject* pProject = &(allProjects[j]);
-        dependencies.push_back(pProject);
-        bFound = true;
-      }
-    }
+  std::set<string_t> entries;
 
-    if (!bFound) {
-      std::cerr<<"Dependency \""<<spitfire::string::ToUTF8(sNameToFind)<<"\" not found for project \""<<spitfire::string::ToUTF8(sName)<<"\""<<std::endl;
+  if (allProjects.empty()) {
+    std::vector<size_t> allDependencies;
+    graph.GetAllDependencies(iProject, allDependencies);
+    allDependencies.push_back(iProject);
+
+    for (size_t j = 0; j < allDependencies.size(); j++) {
+      const size_t i = allDependencies[j];
+      if (revisions[i].empty()) return TEXT("");
+      entries.insert(projects[i].sName + TEXT("=") + revisions[i]);
+    }
+  } else {
+    // The selected projects that a project depends on have their revisions from this run, the others are whatever is checked out
+    std::vector<size_t> allDependencies;
+    allGraph.GetAllDependencies(allProjectIndices[iProject], allDependencies);
+    allDependencies.push_back(allProjectIndices[iProject]);
+
+    for (size_t j = 0; j < allDependencies.size(); j++) {
+      const size_t i = allDependencies[j];
+      const size_t iSelected = selectedProjectIndices[i];
+      const string_t& sRevision = (iSelected != size_t(-1)) ? revisions[iSelected] : unselectedRevisions[i];
+      if (sRevision.empty()) return TEXT("");
+      entries.insert(allProjects[i].sName + TEXT("=") + sRevision);
     }
   }
-}
 
-bool cProject::IsProtocolGit() const
-{
-  const string_t sPossiblyGitProtocol = sURL.substr(0, 3);
-  const bool bIsGit = (sPossiblyGitProtocol == TEXT("git"));
-  return bIsGit;
+  string_t sFingerprint;
+  for (std::set<string_t>::const_iterator iter = entries.begin(); iter != entries.end(); iter++) {
+    if (!sFingerprint.empty()) sFingerprint += TEXT(";");
+    sFingerprint += *iter;
+  }
+
+  return sFingerprint;
 }
 
-bool cProject::IsProtocolSvn() const
+// The fingerprints file contains one "name<tab>fingerprint" line per project, and one "name<tab>target<tab>step<tab>step..." line per target
+// with the steps that it ran when it passed, so that a project that isn't checked out is still reported with the right steps
+void cBuildManager::LoadFingerprints(std::map<string_t, string_t>& fingerprints)
 {
-  return !IsProtocolGit();
+  fingerprints.clear();
+  passedStepNames.clear();
+
+  if (sFingerprintsFilePath.empty()) return;
+
+  std::ifstream file(spitfire::string::ToUTF8(sFingerprintsFilePath).c_str());
+  std::string sLine;
+  while (std::getline(file, sLine)) {
+    std::vector<string_t> fields;
+    std::istringstream line(sLine);
+    std::string sField;
+    while (std::getline(line, sField, '\t')) fields.push_back(spitfire::string::ToString_t(sField));
+
+    if (fields.size() == 2) fingerprints[fields[0]] = fields[1];
+    else if (fields.size() > 2) passedStepNames[std::make_pair(fields[0], fields[1])].assign(fields.begin() + 2, fields.end());
+  }
 }
 
-bool cProject::IsDependentOn(const cProject& rhs) const
+void cBuildManager::SaveFingerprints(const std::map<string_t, string_t>& fingerprints) const
 {
-  const size_t n = dependencies.size();
-  for (size_t i = 0; i < n; i++) {
-    if (dependencies[i]->sName == rhs.sName) return true;
+  if (sFingerprintsFilePath.empty()) return;
+
+  std::map<std::pair<string_t, string_t>, std::vector<string_t> > stepNames(passedStepNames);
+  for (size_t i = 0; i < projects.size(); i++) {
+    const cProject& project = projects[i];
+    for (size_t iTarget = 0; iTarget < project.targets.size(); iTarget++) stepNames[std::make_pair(project.sName, project.targets[iTarget].sName)] = GetStepNames(project, project.targets[iTarget]);
+  }
 
-    if (dependencies[i]->IsDependentOn(rhs)) return true;
+  std::ofstream file(spitfire::string::ToUTF8(sFingerprintsFilePath).c_str());
+  for (std::map<string_t, string_t>::const_iterator iter = fingerprints.begin(); iter != fingerprints.end(); iter++) {
+    file<<spitfire::string::ToUTF8(iter->first)<<'\t'<<spitfire::string::ToUTF8(iter->second)<<'\n';
   }
 
-  return false;
-}
+  for (std::map<std::pair<string_t, string_t>, std::vector<string_t> >::const_iterator iter = stepNames.begin(); iter != stepNames.end(); iter++) {
+    if (fingerprints.find(iter->first.first) == fingerprints.end()) continue;
 
-// *** Comparison for sorting particles based on depth
+    file<<spitfire::string::ToUTF8(iter->first.first)<<'\t'<<spitfire::string::ToUTF8(iter->first.second);
+    for (size_t i = 0; i < iter->second.size(); i++) file<<'\t'<<spitfire::string::ToUTF8(iter->second[i]);
+    file<<'\n';
+  }
 
-inline bool cProject::DependenciesCompare(const cProject& lhs, const cProject& rhs)
-{
-  return lhs.IsDependentOn(rhs);
+  if (!file.good()) LOGERROR<<TEXT("cBuildManager::SaveFingerprints Failed to write \"")<<sFingerprintsFilePath<<TEXT("\"")<<std::endl;
 }
 
-class cBuildManager
+// An append only record of every step of every run, one line per step:
+// time<tab>project<tab>target<tab>step<tab>status<tab>duration<tab>user_ms<tab>system_ms<tab>peak_rss_kb
+// Lines are only ever appended so a run that is killed part way through can't damage the previous runs
+class cHistory
 {
 public:
-  explicit cBuildManager(const string_t& sXMLFilePath);
+  explicit cHistory(const string_t& sFilePath);
 
-  bool IsError() const { return bIsError; }
-  string_t GetError() const { return sErrorMessage; }
+  void SetThresholdPercent(size_t nThresholdPercent);
+  void SetBaselineRuns(size_t nBaselineRuns);
 
-  void ListAllProjects(cReport& report);
-  void BuildAllProjects(cReport& report);
-
-private:
-  void SetError(const string_t& sErrorMessage);
+  void AppendRun(const cReport& report) const;
 
-  void LoadFromXMLFile();
+  void PrintTrends() const;
+  void PrintRegressions() const;
 
-  // Targets
-  bool IsJavaTarget(const cProject& project, const cTarget& target) const;
-  void BuildJava(cReport& report, const cProject& project, const cTarget& target);
-  void BuildCPlusPlus(cReport& report, const cProject& project, const cTarget& target);
-  void TestJava(cReport& report, const cProject& project, const cTarget& target);
-  void TestCPlusPlus(cReport& report, const cProject& project, const cTarget& target);
-  void Build(cReport& report, const cProject& project, const cTarget& target);
-  void Test(cReport& report, const cProject& project, const cTarget& target);
+private:
+  class cStep
+  {
+  public:
+    string_t sProject;
+    string_t sTarget;
+    string_t sStep;
+    std::vector<uint64_t> durationsMS; // Oldest first, only runs where this step passed
+  };
 
-  // Projects
-  bool CheckPrerequisites(cReport& report, const cProject& project);
-  void Clone(cReport& report, const cProject& project);
-  void Build(cReport& report, const cProject& project);
-  void Test(cReport& report, const cProject& project);
+  static std::string GetField(const string_t& sValue);
 
-  string_t sXMLFilePath;
+  void Load(std::vector<cStep>& steps) const;
+  bool IsRegression(const cStep& step, uint64_t& baselineMS) const;
+  void AppendResults(std::ostream& file, time_t now, const string_t& sProject, const string_t& sTarget, const std::vector<cReportResult*>& results) const;
 
-  std::vector<cProject> projects;
+  string_t sFilePath;
+  size_t nThresholdPercent; // How much slower than the baseline a step has to be to count as a regression
+  size_t nBaselineRuns; // How many previous runs the baseline is the median of
+};
 
-  string_t sWorkingFolder;
+cHistory::cHistory(const string_t& _sFilePath) :
+  sFilePath(_sFilePath),
+  nThresholdPercent(50),
+  nBaselineRuns(7)
+{
+}
 
-  bool bIsError;
-  string_t sErrorMessage;
-};
+void cHistory::SetThresholdPercent(size_t _nThresholdPercent)
+{
+  nThresholdPercent = _nThresholdPercent;
+}
 
-cBuildManager::cBuildManager(const string_t& _sXMLFilePath) :
-  sXMLFilePath(_sXMLFilePath),
-  bIsError(false)
+void cHistory::SetBaselineRuns(size_t _nBaselineRuns)
 {
+  nBaselineRuns = std::max<size_t>(1, _nBaselineRuns);
 }
 
-void cBuildManager::SetError(const string_t& _sErrorMessage)
+std::string cHistory::GetField(const string_t& sValue)
 {
-  bIsError = true;
-  sErrorMessage = _sErrorMessage;
-  LOGERROR<<sErrorMessage<<std::endl;
+  // Tabs and new lines would split the record
+  std::string sField = spitfire::string::ToUTF8(sValue);
+  std::replace(sField.begin(), sField.end(), '\t', ' ');
+  std::replace(sField.begin(), sField.end(), '\n', ' ');
+  return sField;
 }
 
-/*
-<build>
-  <project name="PostCodes" url="git://github.com/pilkch/postcodes.git" folder="postcodes">
-    <target name="PostCodes" application="postcodes"/>
-  </project>
+void cHistory::AppendResults(std::ostream& file, time_t now, const string_t& sProject, const string_t& sTarget, const std::vector<cReportResult*>& results) const
+{
+  const size_t nResults = results.size();
+  for (size_t i = 0; i < nResults; i++) {
+    const cReportResult& result = *results[i];
+
+    const char* szStatus = "failed";
+    if (result.IsNotRun()) szStatus = "notrun";
+    else if (result.IsPassed()) szStatus = "passed";
+    else if (result.IsCachedPassed()) szStatus = "cached-pass";
+    else if (result.IsSkipped()) szStatus = "skipped";
+
+    const cResourceUsage& usage = result.GetResourceUsage();
+    file<<now<<'\t'<<GetField(sProject)<<'\t'<<GetField(sTarget)<<'\t'<<GetField(result.GetName())<<'\t'<<szStatus<<'\t'<<usage.wallMS<<'\t'<<usage.userMS<<'\t'<<usage.systemMS<<'\t'<<usage.peakRSSKB<<'\n';
+  }
+}
 
-  <project name="Allocator" url="git://github.com/pilkch/allocator.git" folder="allocator">
-    <target name="Allocator" application="allocator"/>
-  </project>
+void cHistory::AppendRun(const cReport& report) const
+{
+  std::ofstream file(spitfire::string::ToUTF8(sFilePath).c_str(), std::ios::out | std::ios::app);
 
-  <project name="Library" url="git://github.com/pilkch/library.git" folder="library">
-  </project>
+  const time_t now = time(nullptr);
 
-  <project name="Buildall" url="git://github.com/pilkch/buildall.git" folder="buildall">
-    <dependency name="Library"/>
-    <target name="Builall" application="buildall"/>
-  </project>
+  const std::vector<cReportProject*>& projects = report.GetProjects();
+  const size_t nProjects = projects.size();
+  for (size_t iProject = 0; iProject < nProjects; iProject++) {
+    const cReportProject& project = *projects[iProject];
+    AppendResults(file, now, project.GetName(), TEXT(""), project.GetResults());
 
-  <project name="Tetris" url="git://github.com/pilkch/tetris.git" folder="tetris">
-    <dependency name="Library"/>
-    <dependency name="Shared"/>
-    <target name="Tetris" application="tetris" folder="project"/>
-  </project>
+    const std::vector<cReportTarget*>& targets = project.GetTargets();
+    const size_t nTargets = targets.size();
+    for (size_t iTarget = 0; iTarget < nTargets; iTarget++) AppendResults(file, now, project.GetName(), targets[iTarget]->GetName(), targets[iTarget]->GetResults());
+  }
 
-  <project name="Test" url="git://github.com/pilkch/test.git" folder="test">
-    <dependency name="Library"/>
-    <target name="Test libopengmm Fade In" application="openglmm_fadein" folder="openglmm_fadein"/>
-    <target name="Test libopengmm FBO" application="openglmm_fbo" folder="openglmm_fbo"/>
-    <target name="Test libopengmm Font" application="openglmm_font" folder="openglmm_font"/>
-    <target name="Test libopengmm Gears" application="openglmm_gears" folder="openglmm_gears"/>
-    <target name="Test libopengmm Geometry" application="openglmm_geometry" folder="openglmm_geometry"/>
-    <target name="Test libopengmm Heightmap" application="openglmm_heightmap" folder="openglmm_heightmap"/>
-    <target name="Test Permutations" application="permutations" folder="permutations"/>
-    <target name="Test Size" application="size_test" folder="size_test"/>
-    <target name="Source Cleaner" application="source_cleaner" folder="source_cleaner"/>
-    <target name="Test xdgmm" application="xdgmm" folder="xdgmm"/>
-  </project>
-</build>
-*/
+  if (!file.good()) LOGERROR<<TEXT("cHistory::AppendRun Failed to write \"")<<sFilePath<<TEXT("\"")<<std::endl;
+}
 
-/*
-// Not ready yet
+void cHistory::Load(std::vector<cStep>& steps) const
+{
+  steps.clear();
+
+  std::map<std::string, size_t> indices; // "project<tab>target<tab>step" to its index in steps, steps stay in the order they were first seen
+
+  std::ifstream file(spitfire::string::ToUTF8(sFilePath).c_str());
+  std::string sLine;
+  while (std::getline(file, sLine)) {
+    std::vector<std::string> fields;
+    std::istringstream line(sLine);
+    std::string sField;
+    while (std::getline(line, sField, '\t')) fields.push_back(sField);
+    if (fields.size() < 6) continue;
+
+    // Only compare like with like, a failed step usually stops early and a cached step didn't run at all
+    if (fields[4] != "passed") continue;
+
+    const std::string sKey = fields[1] + '\t' + fields[2] + '\t' + fields[3];
+    std::map<std::string, size_t>::const_iterator iter = indices.find(sKey);
+    size_t index = 0;
+    if (iter != indices.end()) index = iter->second;
+    else {
+      index = steps.size();
+      indices[sKey] = index;
+      cStep step;
+      step.sProject = spitfire::string::ToString_t(fields[1]);
+      step.sTarget = spitfire::string::ToString_t(fields[2]);
+      step.sStep = spitfire::string::ToString_t(fields[3]);
+      steps.push_back(step);
+    }
 
-  <project name="Shared" url="https://firestartergame.svn.sourceforge.net/svnroot/firestartergame/shared" folder="shared">
-  </project>
+    steps[index].durationsMS.push_back(strtoull(fields[5].c_str(), nullptr, 10));
+  }
+}
 
-  <project name="OpenSkate" url="https://openskate.svn.sourceforge.net/svnroot/openskate/skate" folder="openskate">
-    <dependency name="Library"/>
-    <dependency name="Shared"/>
-    <target name="OpenSkate" application="skate" folder="project"/>
-  </project>
+// A step has regressed if its latest duration is more than nThresholdPercent slower than the median of the nBaselineRuns before it
+bool cHistory::IsRegression(const cStep& step, uint64_t& baselineMS) const
+{
+  baselineMS = 0;
 
-  <project name="Crank" url="https://firestartergame.svn.sourceforge.net/svnroot/firestartergame/crank" folder="crank">
-    <dependency name="Library"/>
-    <dependency name="Shared"/>
-    <target name="Crank" application="crank" folder="project"/>
-  </project>
+  const size_t n = step.durationsMS.size();
+  if (n < 2) return false;
 
-  <project name="Drive" url="https://drivecity.svn.sourceforge.net/svnroot/drivecity/drive" folder="drive">
-    <dependency name="Library"/>
-    <dependency name="Shared"/>
-    <target name="Drive" application="drive" folder="project"/>
-  </project>
+  const size_t nBaseline = std::min(nBaselineRuns, n - 1);
+  std::vector<uint64_t> baseline(step.durationsMS.end() - 1 - nBaseline, step.durationsMS.end() - 1);
+  std::sort(baseline.begin(), baseline.end());
+  baselineMS = baseline[baseline.size() / 2];
 
-  <project name="Sudoku" url="git://sudokubang.git.sourceforge.net/gitroot/sudokubang/sudokubang" folder="sudoku">
-    <dependency name="Library"/>
-    <dependency name="Shared"/>
-    <target name="Sudoku" application="sudoku" folder="project"/>
-  </project>
+  // Ignore jitter on steps that only take a moment
+  const uint64_t minimumDifferenceMS = 1000;
 
-  <project name="FireStarter" url="https://firestartergame.svn.sourceforge.net/svnroot/firestartergame/firestarter" folder="firestarter">
-    <dependency name="Library"/>
-    <dependency name="Shared"/>
-    <target name="FireStarter" application="firestarter" folder="project"/>
-  </project>
-*/
+  const uint64_t latestMS = step.durationsMS.back();
+  return (latestMS > baselineMS + minimumDifferenceMS) && ((latestMS * 100) > (baselineMS * (100 + nThresholdPercent)));
+}
 
-void cBuildManager::LoadFromXMLFile()
+void cHistory::PrintTrends() const
 {
-  projects.clear();
+  std::vector<cStep> steps;
+  Load(steps);
 
-  std::cout<<"cBuildManager::LoadFromXMLFile \""<<spitfire::string::ToUTF8(sXMLFilePath)<<"\""<<std::endl;
-  if (!spitfire::filesystem::FileExists(sXMLFilePath)) {
-    SetError(TEXT("XML File \"") + sXMLFilePath + TEXT("\" doesn't exist"));
+  if (steps.empty()) {
+    std::cout<<"No history found in \""<<spitfire::string::ToUTF8(sFilePath)<<"\""<<std::endl;
     return;
   }
 
-  spitfire::util::cProcessInterfaceVoid interface;
+  string_t sLastProject;
+  const size_t nSteps = steps.size();
+  for (size_t i = 0; i < nSteps; i++) {
+    const cStep& step = steps[i];
+    if (step.sProject != sLastProject) {
+      std::cout<<spitfire::string::ToUTF8(step.sProject)<<std::endl;
+      sLastProject = step.sProject;
+    }
 
-  spitfire::document::cDocument document;
+    std::cout<<"  ";
+    if (!step.sTarget.empty()) std::cout<<spitfire::string::ToUTF8(step.sTarget)<<" ";
+    std::cout<<spitfire::string::ToUTF8(step.sStep)<<":";
 
-  {
-    // Read the xml file
-    spitfire::xml::reader reader;
+    // The last few durations, oldest first
+    const size_t n = step.durationsMS.size();
+    for (size_t j = ((n > nBaselineRuns + 1) ? (n - nBaselineRuns - 1) : 0); j < n; j++) std::cout<<" "<<step.durationsMS[j]<<"ms";
 
-    reader.ReadFromFile(interface, document, sXMLFilePath);
+    uint64_t baselineMS = 0;
+    if (IsRegression(step, baselineMS)) std::cout<<" REGRESSED (Baseline "<<baselineMS<<"ms)";
+    std::cout<<std::endl;
   }
+}
 
-  // Parse the xml file
-  spitfire::document::cNode::iterator iterProject(document);
-  if (!iterProject.IsValid()) {
-    SetError(TEXT("build.xml does not contain valid xml data"));
-    return;
+void cHistory::PrintRegressions() const
+{
+  std::vector<cStep> steps;
+  Load(steps);
+
+  const size_t nSteps = steps.size();
+  for (size_t i = 0; i < nSteps; i++) {
+    const cStep& step = steps[i];
+    uint64_t baselineMS = 0;
+    if (IsRegression(step, baselineMS)) {
+      LOGERROR<<TEXT("Regression: \"")<<step.sProject<<TEXT("\" ")<<step.sTarget<<(step.sTarget.empty() ? TEXT("") : TEXT(" "))<<step.sStep<<TEXT(" took ")<<step.durationsMS.back()<<TEXT("ms, baseline ")<<baselineMS<<TEXT("ms")<<std::endl;
+    }
   }
+}
 
-  iterProject.FindChild("build");
-  if (!iterProject.IsValid()) {
-    SetError(TEXT("build.xml does not contain a build root node"));
-    return;
-  }
 
-  iterProject.FindChild("project");
-  while (iterProject.IsValid()) {
-    cProject project;
-    if (!iterProject.GetAttribute("name", project.sName)) {
-      SetError(TEXT("build.xml contains a project without a name"));
-      return;
-    }
+// Writes results.json a project at a time as each project finishes instead of building the whole document at the end, and writes
+// the same project objects one per line to a results.jsonl companion file
+// Both files are flushed after every project, so if buildall is killed part way through a run results.jsonl still holds every
+// project that finished, while results.json only becomes a complete document when the run finishes
+class cResultsWriter : public cBuildObserver
+{
+public:
+  bool Open(const string_t& sFilePath, const string_t& sLinesFilePath);
+  void Close(const cReport& report);
 
-    std::cout<<"project \""<<spitfire::string::ToUTF8(project.sName)<<"\""<<std::endl;
+  virtual void OnProjectFinished(const cReportProject& project);
 
-    if (!iterProject.GetAttribute("url", project.sURL)) {
-      SetError(TEXT("build.xml contains a project without a url"));
-      return;
-    }
+private:
+  void WriteProject(const cReportProject& project);
+  void WriteResults(std::ostream& o, const std::vector<cReportResult*>& results) const;
 
-    std::cout<<"url \""<<spitfire::string::ToUTF8(project.sURL)<<"\""<<std::endl;
+  std::mutex mutex;
+  std::ofstream file;
+  std::ofstream linesFile;
+  std::set<string_t> written; // Projects that have already been written
+};
 
-    if (!iterProject.GetAttribute("folder", project.sFolderName)) {
-      SetError(TEXT("build.xml contains a project without a folder"));
-      return;
-    }
+bool cResultsWriter::Open(const string_t& sFilePath, const string_t& sLinesFilePath)
+{
+  std::lock_guard<std::mutex> lock(mutex);
 
-    std::cout<<"folder \""<<spitfire::string::ToUTF8(project.sFolderName)<<"\""<<std::endl;
+  written.clear();
 
-    for (spitfire::document::cNode::iterator iter = iterProject.GetFirstChild(); iter.IsValid(); iter.Next()) {
-      const std::string sType = iter.GetName();
+  file.open(spitfire::string::ToUTF8(sFilePath).c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
+  linesFile.open(spitfire::string::ToUTF8(sLinesFilePath).c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
+  if (!file.is_open() || !linesFile.is_open()) {
+    LOGERROR<<TEXT("cResultsWriter::Open Failed to open \"")<<sFilePath<<TEXT("\" or \"")<<sLinesFilePath<<TEXT("\"")<<std::endl;
+    return false;
+  }
 
-      if (sType == "dependency") {
-        //<dependency name="Library"/>
-        std::cout<<"dependency"<<std::endl;
-        string_t sDependency;
-        if (!iter.GetAttribute("name", sDependency)) {
-          SetError(TEXT("build.xml contains a dependency without a name"));
-          return;
-        }
+  file<<"{\"projects\":[";
+  file.flush();
+  return true;
+}
 
-        project.dependenciesAsString.push_back(sDependency);
-      } else if (sType == "target") {
-        //<target name="OpenSkate" application="skate" folder="project"/>
-        std::cout<<"target"<<std::endl;
+void cResultsWriter::OnProjectFinished(const cReportProject& project)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  WriteProject(project);
+}
 
-        cTarget target;
+// Write any projects that never finished (Because one of their dependencies failed for example) and then the summary of the run
+void cResultsWriter::Close(const cReport& report)
+{
+  std::lock_guard<std::mutex> lock(mutex);
 
-        if (!iter.GetAttribute("name", target.sName)) {
-          SetError(TEXT("build.xml project contains a target without a name"));
-          return;
-        }
+  if (!file.is_open()) return;
 
-        if (!iter.GetAttribute("application", target.sApplication)) {
-          SetError(TEXT("build.xml project contains a target without a application"));
-          return;
-        }
+  const std::vector<cReportProject*>& projects = report.GetProjects();
+  const size_t nProjects = projects.size();
+  for (size_t iProject = 0; iProject < nProjects; iProject++) WriteProject(*projects[iProject]);
+
+  std::ostringstream o;
+  o<<"\"critical_path_ms\":"<<GetJSONString(report.GetCriticalPathDurationMS())<<",\"critical_path\":[";
+  const std::vector<cCriticalPathStep>& criticalPath = report.GetCriticalPath();
+  const size_t nSteps = criticalPath.size();
+  for (size_t iStep = 0; iStep < nSteps; iStep++) {
+    const cCriticalPathStep& step = criticalPath[iStep];
+    if (iStep != 0) o<<",";
+    o<<"{\"project\":"<<GetJSONString(step.sProject);
+    if (!step.sTarget.empty()) o<<",\"target\":"<<GetJSONString(step.sTarget);
+    o<<",\"step\":"<<GetJSONString(step.sStep)<<",\"duration\":"<<GetJSONString(step.durationMS)<<"}";
+  }
+  o<<"],\"slack\":[";
+  for (size_t iProject = 0; iProject < nProjects; iProject++) {
+    const cReportProject& project = *projects[iProject];
+    if (iProject != 0) o<<",";
+    o<<"{\"project\":"<<GetJSONString(project.GetName())<<",\"critical\":"<<(project.IsOnCriticalPath() ? "\"true\"" : "\"false\"")<<",\"slack_ms\":"<<GetJSONString(project.GetSlackMS())<<"}";
+  }
+  o<<"]";
 
-        iter.GetAttribute("folder", target.sFolder);
+  file<<"],"<<o.str()<<"}"<<std::endl;
+  linesFile<<"{"<<o.str()<<"}"<<std::endl;
 
-        project.targets.push_back(target);
-      } else {
-        std::cerr<<"build.xml contains a project (\""<<spitfire::string::ToUTF8(project.sName)<<"\") with an unknown type \""<<spitfire::string::ToUTF8(sType)<<"\""<<std::endl;
-      }
-    }
+  if (!file.good() || !linesFile.good()) LOGERROR<<TEXT("cResultsWriter::Close Failed to write the results")<<std::endl;
 
-    projects.push_back(project);
+  file.close();
+  linesFile.close();
+}
 
-    iterProject.Next("project");
+void cResultsWriter::WriteResults(std::ostream& o, const std::vector<cReportResult*>& results) const
+{
+  o<<"[";
+  const size_t nResults = results.size();
+  for (size_t iResult = 0; iResult < nResults; iResult++) {
+    const cReportResult& result = *results[iResult];
+    assert(!result.GetName().empty());
+    if (iResult != 0) o<<",";
+    o<<"{\"name\":"<<GetJSONString(result.GetName())<<",\"status\":";
+    if (result.IsNotRun()) o<<"\"notrun\"";
+    else if (result.IsPassed()) o<<"\"passed\"";
+    else if (result.IsCachedPassed()) o<<"\"cached-pass\"";
+    else if (result.IsSkipped()) o<<"\"skipped\"";
+    else o<<"\"failed\"";
+
+    const cResourceUsage& usage = result.GetResourceUsage();
+    o<<",\"duration\":"<<GetJSONString(usage.wallMS)<<",\"user_ms\":"<<GetJSONString(usage.userMS)<<",\"system_ms\":"<<GetJSONString(usage.systemMS)<<",\"peak_rss_kb\":"<<GetJSONString(usage.peakRSSKB);
+    const uint64_t compilations = usage.compilerCacheHits + usage.compilerCacheMisses;
+    if (compilations != 0) {
+      o<<",\"ccache_hits\":"<<GetJSONString(usage.compilerCacheHits)<<",\"ccache_misses\":"<<GetJSONString(usage.compilerCacheMisses);
+      o<<",\"ccache_hit_rate\":"<<GetJSONString((100 * usage.compilerCacheHits) / compilations);
+    }
+    o<<"}";
   }
-
-  const size_t n = projects.size();
-  for (size_t i = 0; i < n; i++) projects[i].BuildDepencenciesGraph(projects);
+  o<<"]";
 }
 
-bool cBuildManager::CheckPrerequisites(cReport& report, const cProject& project)
+// NOTE: Only called with mutex locked
+void cResultsWriter::WriteProject(const cReportProject& project)
 {
-  const bool bIsGit = project.IsProtocolGit();
-
-  // Find out whether the executable for this protocol is installed
-  string_t sExecutable;
-  if (bIsGit) sExecutable = "git";
-  else sExecutable = "svn";
+  if (!file.is_open()) return;
+  if (!written.insert(project.GetName()).second) return;
+
+  std::ostringstream o;
+  o<<"{\"name\":"<<GetJSONString(project.GetName())<<",\"results\":";
+  WriteResults(o, project.GetResults());
+  o<<",\"targets\":[";
+  const std::vector<cReportTarget*>& targets = project.GetTargets();
+  const size_t nTargets = targets.size();
+  for (size_t iTarget = 0; iTarget < nTargets; iTarget++) {
+    if (iTarget != 0) o<<",";
+    o<<"{\"name\":"<<GetJSONString(targets[iTarget]->GetName())<<",\"results\":";
+    WriteResults(o, targets[iTarget]->GetResults());
+    o<<"}";
+  }
+  o<<"]}";
 
-  const string_t sCommand = "which " + sExecutable;
+  if (written.size() != 1) file<<",";
+  file<<o.str();
+  file.flush();
 
-  int iReturnCode = -1;
-  const string_t sOutput = spitfire::platform::PipeReadToString(sCommand, iReturnCode);
-  const bool bFound = (sOutput.find(sExecutable) != std::string::npos);
-  if (!bFound) SetError("Tool \"" + sExecutable + "\" for project \"" + project.sName + "\" has not been installed yet");
-  return bFound;
+  linesFile<<o.str()<<"\n";
+  linesFile.flush();
 }
 
-void cBuildManager::Clone(cReport& report, const cProject& project)
+
+// Publishes newline delimited json events about a running build on a UNIX domain socket, so that a wallboard or an alert can follow
+// the build as it happens, any number of clients can connect, for example with "socat - UNIX-CONNECT:<socket>"
+// New connections are accepted when the next event is published and nothing is queued, a client that can't keep up is disconnected
+// rather than slowing down the build
+class cEventServer : public cBuildObserver
 {
-  const bool bIsGit = project.IsProtocolGit();
+public:
+  cEventServer();
+  ~cEventServer();
 
-  string_t sCommand;
-  if (bIsGit) sCommand = TEXT("git clone --depth 1");
-  else sCommand = TEXT("svn co");
+  bool Open(const string_t& sSocketPath);
+  void Close();
 
-  sCommand += TEXT(" ") + project.sURL + TEXT(" ") + spitfire::filesystem::MakeFilePath(sWorkingFolder, project.sFolderName);
+  virtual void OnProjectReady(const string_t& sProject);
+  virtual void OnProjectBlocked(const string_t& sProject, const string_t& sDependency);
+  virtual void OnStepStarted(const string_t& sProject, const string_t& sTarget, const string_t& sStep);
+  virtual void OnStepFinished(const string_t& sProject, const string_t& sTarget, const string_t& sStep, bool bPassed, const cResourceUsage& usage);
+  virtual void OnProjectFinished(const cReportProject& project);
 
-  LOG<<TEXT("cBuildManager::Clone sCommand=\"")<<sCommand<<TEXT("\"")<<std::endl;
+private:
+  static std::string GetEvent(const char* szEvent, const string_t& sProject);
+  void Publish(const std::string& sEvent);
 
-  int iReturnCode = -1;
-  std::string sBuffer = spitfire::platform::PipeReadToString(sCommand, iReturnCode);
-  if (iReturnCode != 0) {
-    ostringstream_t o;
-    o<<TEXT("cBuildManager::Clone Process \"")<<sCommand<<TEXT("\" returned ")<<iReturnCode<<TEXT(", sBuffer=\"")<<spitfire::string::ToString_t(sBuffer)<<TEXT("\"")<<std::endl;
-    SetError(o.str());
-    report.SetTestResultFailed(project.sName, TEXT("clone"));
-  } else {
-    #ifdef BUILD_DEBUG
-    LOG<<TEXT("cBuildManager::Clone Process \"")<<sCommand<<TEXT("\" returned ")<<iReturnCode<<TEXT(", sBuffer=\"")<<spitfire::string::ToString_t(sBuffer)<<TEXT("\"")<<std::endl;
-    #endif
-    report.SetTestResultPassed(project.sName, TEXT("clone"));
-  }
-}
+  std::mutex mutex;
+  string_t sSocketPath;
+  int fdListen;
+  std::vector<int> clients;
+};
 
-bool cBuildManager::IsJavaTarget(const cProject& project, const cTarget& target) const
+cEventServer::cEventServer() :
+  fdListen(-1)
 {
-  const string_t sTargetFolder = spitfire::filesystem::MakeFilePath(sWorkingFolder, project.sFolderName, target.sFolder);
+}
 
-  // If there is a build.xml file within this directory then it is probably an Ant make file and we should treat it as a Java project
-  const string_t sBuildXML = spitfire::filesystem::MakeFilePath(sTargetFolder, TEXT("build.xml"));
-  return spitfire::filesystem::FileExists(sBuildXML);
+cEventServer::~cEventServer()
+{
+  Close();
 }
 
-void cBuildManager::BuildJava(cReport& report, const cProject& project, const cTarget& target)
+bool cEventServer::Open(const string_t& _sSocketPath)
 {
-  // Run ant build
-  {
-    const string_t sCommand = TEXT("ant build");
+  Close();
 
-    int iReturnCode = -1;
-    std::string sBuffer = spitfire::platform::PipeReadToString(sCommand, iReturnCode);
-    if (iReturnCode != 0) {
-      ostringstream_t o;
-      o<<TEXT("cBuildManager::BuildJava ant build process \"")<<sCommand<<TEXT("\" returned ")<<iReturnCode<<TEXT(", sBuffer=\"")<<spitfire::string::ToString_t(sBuffer)<<TEXT("\"")<<std::endl;
-      SetError(o.str());
-      report.SetTestResultFailed(project.sName, target.sName, TEXT("ant build"));
-      return;
-    } else {
-      #ifdef BUILD_DEBUG
-      LOG<<TEXT("cBuildManager::BuildJava ant build process \"")<<sCommand<<TEXT("\" returned ")<<iReturnCode<<TEXT(", sBuffer=\"")<<spitfire::string::ToString_t(sBuffer)<<TEXT("\"")<<std::endl;
-      #endif
-      report.SetTestResultPassed(project.sName, target.sName, TEXT("ant build"));
-    }
+  std::lock_guard<std::mutex> lock(mutex);
+
+  const std::string sPathUTF8 = spitfire::string::ToUTF8(_sSocketPath);
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (sPathUTF8.length() >= sizeof(address.sun_path)) {
+    LOGERROR<<TEXT("cEventServer::Open Socket path \"")<<_sSocketPath<<TEXT("\" is too long")<<std::endl;
+    return false;
   }
-}
+  strncpy(address.sun_path, sPathUTF8.c_str(), sizeof(address.sun_path) - 1);
 
-void cBuildManager::BuildCPlusPlus(cReport& report, const cProject& project, const cTarget& target)
-{
-  // Run cmake
-  {
-    const string_t sCommand = TEXT("cmake .");
+  // Remove the socket left behind by a previous run
+  unlink(sPathUTF8.c_str());
 
-    int iReturnCode = -1;
-    std::string sBuffer = spitfire::platform::PipeReadToString(sCommand, iReturnCode);
-    if (iReturnCode != 0) {
-      ostringstream_t o;
-      o<<TEXT("cBuildManager::BuildCPlusPlus cmake process \"")<<sCommand<<TEXT("\" returned ")<<iReturnCode<<TEXT(", sBuffer=\"")<<spitfire::string::ToString_t(sBuffer)<<TEXT("\"")<<std::endl;
-      SetError(o.str());
-      report.SetTestResultFailed(project.sName, target.sName, TEXT("cmake"));
-      return;
-    } else {
-      #ifdef BUILD_DEBUG
-      LOG<<TEXT("cBuildManager::BuildCPlusPlus cmake process \"")<<sCommand<<TEXT("\" returned ")<<iReturnCode<<TEXT(", sBuffer=\"")<<spitfire::string::ToString_t(sBuffer)<<TEXT("\"")<<std::endl;
-      #endif
-      report.SetTestResultPassed(project.sName, target.sName, TEXT("cmake"));
-    }
+  fdListen = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if ((fdListen == -1) || (bind(fdListen, (const sockaddr*)&address, sizeof(address)) != 0) || (listen(fdListen, 16) != 0)) {
+    LOGERROR<<TEXT("cEventServer::Open Failed to listen on \"")<<_sSocketPath<<TEXT("\", errno=")<<errno<<std::endl;
+    if (fdListen != -1) close(fdListen);
+    fdListen = -1;
+    return false;
   }
 
-  // Run make
-  {
-    const string_t sCommand = TEXT("make");
+  sSocketPath = _sSocketPath;
+  return true;
+}
+
+void cEventServer::Close()
+{
+  std::lock_guard<std::mutex> lock(mutex);
 
-    int iReturnCode = -1;
-    std::string sBuffer = spitfire::platform::PipeReadToString(sCommand, iReturnCode);
-    if (iReturnCode != 0) {
-      ostringstream_t o;
-      o<<TEXT("cBuildManager::BuildCPlusPlus make process \"")<<sCommand<<TEXT("\" returned ")<<iReturnCode<<TEXT(", sBuffer=\"")<<spitfire::string::ToString_t(sBuffer)<<TEXT("\"")<<std::endl;
-      SetError(o.str());
-      report.SetTestResultFailed(project.sName, target.sName, TEXT("make"));
-    } else {
-      #ifdef BUILD_DEBUG
-      LOG<<TEXT("cBuildManager::BuildCPlusPlus make process \"")<<sCommand<<TEXT("\" returned ")<<iReturnCode<<TEXT(", sBuffer=\"")<<spitfire::string::ToString_t(sBuffer)<<TEXT("\"")<<std::endl;
-      #endif
-      report.SetTestResultPassed(project.sName, target.sName, TEXT("make"));
-    }
+  const size_t n = clients.size();
+  for (size_t i = 0; i < n; i++) close(clients[i]);
+  clients.clear();
+
+  if (fdListen != -1) {
+    close(fdListen);
+    fdListen = -1;
+    unlink(spitfire::string::ToUTF8(sSocketPath).c_str());
   }
 }
 
-void cBuildManager::Build(cReport& report, const cProject& project, const cTarget& target)
+std::string cEventServer::GetEvent(const char* szEvent, const string_t& sProject)
 {
-  const string_t sTargetFolder = spitfire::filesystem::MakeFilePath(sWorkingFolder, project.sFolderName, target.sFolder);
+  std::ostringstream o;
+  o<<"{\"event\":\""<<szEvent<<"\",\"time\":"<<GetJSONString(uint64_t(time(nullptr)))<<",\"project\":"<<GetJSONString(sProject);
+  return o.str();
+}
 
-  // Change to the target directory so that cmake and make will work
-  spitfire::filesystem::cScopedDirectoryChangeMainThread changeDirectory(sTargetFolder);
+void cEventServer::OnProjectReady(const string_t& sProject)
+{
+  Publish(GetEvent("project_ready", sProject) + "}");
+}
 
-  if (IsJavaTarget(project, target)) BuildJava(report, project, target);
-  else BuildCPlusPlus(report, project, target);
+void cEventServer::OnProjectBlocked(const string_t& sProject, const string_t& sDependency)
+{
+  Publish(GetEvent("project_blocked", sProject) + ",\"dependency\":" + GetJSONString(sDependency) + "}");
 }
 
-void cBuildManager::Build(cReport& report, const cProject& project)
+void cEventServer::OnStepStarted(const string_t& sProject, const string_t& sTarget, const string_t& sStep)
 {
-  const size_t n = project.targets.size();
-  for (size_t i = 0; i < n; i++) {
-    Build(report, project, project.targets[i]);
-  }
+  std::string sEvent = GetEvent("step_started", sProject);
+  if (!sTarget.empty()) sEvent += ",\"target\":" + GetJSONString(sTarget);
+  Publish(sEvent + ",\"step\":" + GetJSONString(sStep) + "}");
 }
 
-void cBuildManager::TestJava(cReport& report, const cProject& project, const cTarget& target)
+void cEventServer::OnStepFinished(const string_t& sProject, const string_t& sTarget, const string_t& sStep, bool bPassed, const cResourceUsage& usage)
 {
-  // TODO: Pass --unittest and actually test the built application
-  /*// Run ant Application
-  {
-    const string_t sCommand = TEXT("ant Application");
+  std::string sEvent = GetEvent("step_finished", sProject);
+  if (!sTarget.empty()) sEvent += ",\"target\":" + GetJSONString(sTarget);
+  sEvent += ",\"step\":" + GetJSONString(sStep) + ",\"status\":" + (bPassed ? "\"passed\"" : "\"failed\"") + ",\"duration\":" + GetJSONString(usage.wallMS);
+  Publish(sEvent + "}");
+}
 
-    int iReturnCode = -1;
-    std::string sBuffer = spitfire::platform::PipeReadToString(sCommand, iReturnCode);
-    if (iReturnCode != 0) {
-      ostringstream_t o;
-      o<<TEXT("cBuildManager::TestJava ant Application process \"")<<sCommand<<TEXT("\" returned ")<<iReturnCode<<TEXT(", sBuffer=\"")<<spitfire::string::ToString_t(sBuffer)<<TEXT("\"")<<std::endl;
-      SetError(o.str());
-      report.SetTestResultFailed(project.sName, TEXT("ant Application"));
-      return;
-    } else {
-      #ifdef BUILD_DEBUG
-      LOG<<TEXT("cBuildManager::TestJava ant Application process \"")<<sCommand<<TEXT("\" returned ")<<iReturnCode<<TEXT(", sBuffer=\"")<<spitfire::string::ToString_t(sBuffer)<<TEXT("\"")<<std::endl;
-      #endif
-      report.SetTestResultPassed(project.sName, target.sName, TEXT("ant Application"));
+void cEventServer::OnProjectFinished(const cReportProject& project)
+{
+  bool bFailed = false;
+  bool bSkipped = false;
+  const std::vector<cReportResult*>& results = project.GetResults();
+  for (size_t i = 0; i < results.size(); i++) {
+    if (results[i]->IsFailed()) bFailed = true;
+  }
+  const std::vector<cReportTarget*>& targets = project.GetTargets();
+  for (size_t i = 0; i < targets.size(); i++) {
+    const std::vector<cReportResult*>& targetResults = targets[i]->GetResults();
+    for (size_t j = 0; j < targetResults.size(); j++) {
+      if (targetResults[j]->IsFailed()) bFailed = true;
+      else if (targetResults[j]->IsSkipped()) bSkipped = true;
     }
-  }*/
+  }
+
+  const char* szStatus = "\"passed\"";
+  if (bFailed) szStatus = "\"failed\"";
+  else if (bSkipped) szStatus = "\"skipped\"";
+
+  Publish(GetEvent("project_finished", project.GetName()) + ",\"status\":" + szStatus + "}");
 }
 
-void cBuildManager::TestCPlusPlus(cReport& report, const cProject& project, const cTarget& target)
+void cEventServer::Publish(const std::string& sEvent)
 {
-  const string_t sApplication = spitfire::filesystem::MakeFilePath(spitfire::filesystem::MakeFilePath(sWorkingFolder, project.sFolderName, target.sFolder), target.sApplication);
+  std::lock_guard<std::mutex> lock(mutex);
 
-  // Make sure that the application has been built sucessfully
-  assert(spitfire::filesystem::FileExists(sApplication));
+  if (fdListen == -1) return;
 
-  // Run application with unittest parameter
-  const string_t sCommand = sApplication + TEXT(" --unittest");
+  // Accept any clients that have connected since the last event
+  while (true) {
+    const int fd = accept4(fdListen, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1) break;
+    clients.push_back(fd);
+  }
 
-  {
-    int iReturnCode = -1;
-    std::string sBuffer = spitfire::platform::PipeReadToString(sCommand, iReturnCode);
-    if (iReturnCode != 0) {
-      ostringstream_t o;
-      o<<TEXT("cBuildManager::TestCPlusPlus Process \"")<<sCommand<<TEXT("\" returned ")<<iReturnCode<<TEXT(", sBuffer=\"")<<spitfire::string::ToString_t(sBuffer)<<TEXT("\"")<<std::endl;
-      SetError(o.str());
-    } else {
-      #ifdef BUILD_DEBUG
-      LOG<<TEXT("cBuildManager::TestCPlusPlus Process \"")<<sCommand<<TEXT("\" returned ")<<iReturnCode<<TEXT(", sBuffer=\"")<<spitfire::string::ToString_t(sBuffer)<<TEXT("\"")<<std::endl;
-      #endif
-    }
+  const std::string sLine = sEvent + "\n";
+
+  std::vector<int>::iterator iter = clients.begin();
+  while (iter != clients.end()) {
+    // A partial write would leave half an event in the stream so that counts as a failure too
+    const ssize_t nSent = send(*iter, sLine.c_str(), sLine.length(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (nSent != ssize_t(sLine.length())) {
+      close(*iter);
+      iter = clients.erase(iter);
+    } else iter++;
   }
 }
 
-void cBuildManager::Test(cReport& report, const cProject& project, const cTarget& target)
+
+// Uploads results to the server from config.xml on a background thread so that a slow or broken server never holds up a run
+// Each file is gzip compressed into the spool folder first and is only removed from there once it has been uploaded, a file that
+// failed to upload is retried by later runs, waiting twice as long after each failure
+class cUploader
 {
-  const string_t sTargetFolder = spitfire::filesystem::MakeFilePath(sWorkingFolder, project.sFolderName, target.sFolder);
+public:
+  cUploader(const string_t& sSpoolFolder, const std::string& sHostUTF8, const std::string& sPathUTF8, const std::string& sSecretUTF8);
+  ~cUploader();
+
+  bool IsConfigured() const { return (!sHostUTF8.empty() && !sPathUTF8.empty()); }
+
+  void Start(); // Starts the upload thread with any files left in the spool folder by earlier runs that are due to be retried
+  void Add(const string_t& sFilePath); // Compresses a copy of the file into the spool folder and queues it for uploading
+  void Finish(); // Waits for the queued uploads, files that failed to upload stay in the spool folder for the next run
+
+private:
+  static const uint64_t retryDelaySeconds = 60;
+  static const uint64_t maxRetryDelaySeconds = 24 * 60 * 60;
+
+  bool Compress(const string_t& sFilePath, const string_t& sCompressedFilePath) const;
+  bool Upload(const string_t& sSpoolFilePath) const;
+  void SetUploadFailed(const string_t& sSpoolFilePath) const;
+  bool IsDue(const string_t& sSpoolFilePath) const;
+  void GetDueFiles(std::vector<string_t>& files) const;
+
+  void Run();
+
+  string_t sSpoolFolder;
+  std::string sHostUTF8;
+  std::string sPathUTF8;
+  std::string sSecretUTF8;
+
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::list<string_t> queue; // Spool files waiting to be uploaded
+  bool bFinishing;
+  uint64_t nAdded; // Keeps the names of files spooled within the same second apart
+};
 
-  if (IsJavaTarget(project, target)) TestJava(report, project, target);
-  else TestCPlusPlus(report, project, target);
+cUploader::cUploader(const string_t& _sSpoolFolder, const std::string& _sHostUTF8, const std::string& _sPathUTF8, const std::string& _sSecretUTF8) :
+  sSpoolFolder(_sSpoolFolder),
+  sHostUTF8(_sHostUTF8),
+  sPathUTF8(_sPathUTF8),
+  sSecretUTF8(_sSecretUTF8),
+  bFinishing(false),
+  nAdded(0)
+{
 }
 
-void cBuildManager::Test(cReport& report, const cProject& project)
+cUploader::~cUploader()
 {
-  const size_t n = project.targets.size();
-  for (size_t i = 0; i < n; i++) {
-    Test(report, project, project.targets[i]);
-    if (IsError()) return;
-  }
+  Finish();
 }
 
-void cBuildManager::ListAllProjects(cReport& report)
+void cUploader::Start()
 {
-  LoadFromXMLFile();
-  if (IsError()) return;
+  if (!IsConfigured()) return;
 
-  if (projects.empty()) {
-    SetError(TEXT("No projects found"));
+  if (!spitfire::filesystem::DirectoryExists(sSpoolFolder) && !spitfire::filesystem::CreateDirectory(sSpoolFolder)) {
+    LOGERROR<<TEXT("cUploader::Start Failed to create spool folder \"")<<sSpoolFolder<<TEXT("\"")<<std::endl;
     return;
   }
 
-  const size_t n = projects.size();
-  for (size_t i = 0; i < n; i++) {
-    const cProject& project = projects[i];
-    std::cout<<spitfire::string::ToUTF8(project.sName)<<std::endl;
+  // Queue the files that earlier runs failed to upload, oldest first
+  std::vector<string_t> files;
+  GetDueFiles(files);
 
-    const size_t nTargets = project.targets.size();
-    for (size_t j = 0; j < nTargets; j++) {
-      const cTarget& target = project.targets[i];
-      std::cout<<spitfire::string::ToUTF8(target.sName)<<std::endl;
-    }
-  }
+  std::lock_guard<std::mutex> lock(mutex);
+  queue.insert(queue.end(), files.begin(), files.end());
+  bFinishing = false;
+  thread = std::thread(&cUploader::Run, this);
 }
 
-void cBuildManager::BuildAllProjects(cReport& report)
+void cUploader::Add(const string_t& sFilePath)
 {
-  LoadFromXMLFile();
-  if (IsError()) return;
+  if (!IsConfigured() || !thread.joinable()) return;
 
-  if (projects.empty()) {
-    SetError(TEXT("No projects found"));
-    return;
-  }
+  // The time goes first so that the spool folder sorts oldest first, the daemon can finish two builds within a second so a counter keeps them apart
+  ostringstream_t o;
+  o<<TEXT("results-")<<uint64_t(time(nullptr))<<TEXT("-")<<getpid()<<TEXT("-")<<std::setw(6)<<std::setfill('0')<<nAdded<<TEXT(".json.gz");
+  nAdded++;
+  const string_t sSpoolFilePath = spitfire::filesystem::MakeFilePath(sSpoolFolder, o.str());
+  if (!Compress(sFilePath, sSpoolFilePath)) return;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (std::find(queue.begin(), queue.end(), sSpoolFilePath) == queue.end()) queue.push_back(sSpoolFilePath);
+  condition.notify_one();
+}
 
-  const size_t nProjects = projects.size();
+void cUploader::Finish()
+{
+  if (!thread.joinable()) return;
 
-  LOG<<"Checking prerequisites for projects"<<std::endl;
-  bool bPrerequisitesFailed = false;
-  for (size_t i = 0; i < nProjects; i++) {
-    const cProject& project = projects[i];
-    if (!CheckPrerequisites(report, project)) bPrerequisitesFailed = true;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    bFinishing = true;
+    condition.notify_one();
   }
 
-  if (bPrerequisitesFailed) {
-    SetError(TEXT("Prerequisites failed"));
-    return;
-  }
+  thread.join();
+}
 
-  // Create a list of our projects that is sorted by least dependencies to most dependencies
-  std::vector<cProject> projectsSorted = projects;
-  std::sort(projectsSorted.begin(), projectsSorted.end(), cProject::DependenciesCompare);
+bool cUploader::Compress(const string_t& sFilePath, const string_t& sCompressedFilePath) const
+{
+  // Compress to a temporary file and then rename it so that the spool folder never has a partial file in it
+  const string_t sTemporaryFilePath = sCompressedFilePath + TEXT(".tmp");
+  {
+    std::ifstream input(spitfire::string::ToUTF8(sFilePath).c_str(), std::ios::in | std::ios::binary);
+    std::ofstream output(spitfire::string::ToUTF8(sTemporaryFilePath).c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!input.is_open() || !output.is_open()) {
+      LOGERROR<<TEXT("cUploader::Compress Failed to compress \"")<<sFilePath<<TEXT("\" to \"")<<sTemporaryFilePath<<TEXT("\"")<<std::endl;
+      return false;
+    }
 
-  // Add an entry for each project to the report
-  for (size_t i = 0; i < nProjects; i++) {
-    const cProject& project = projects[i];
-    report.AddProject(project.sName);
-    report.AddTest(project.sName, TEXT("clone"));
+    boost::iostreams::filtering_ostreambuf compressed;
+    compressed.push(boost::iostreams::gzip_compressor());
+    compressed.push(output);
+    boost::iostreams::copy(input, compressed);
   }
 
-  spitfire::filesystem::cScopedTemporaryFolder temp;
+  if (rename(spitfire::string::ToUTF8(sTemporaryFilePath).c_str(), spitfire::string::ToUTF8(sCompressedFilePath).c_str()) != 0) {
+    LOGERROR<<TEXT("cUploader::Compress Failed to rename \"")<<sTemporaryFilePath<<TEXT("\", errno=")<<errno<<std::endl;
+    std::remove(spitfire::string::ToUTF8(sTemporaryFilePath).c_str());
+    return false;
+  }
 
-  sWorkingFolder = temp.GetFolder();
+  return true;
+}
 
-  // Pull all projects
-  LOG<<TEXT("Cloning Projects")<<std::endl;
-  for (size_t i = 0; i < nProjects; i++) {
-    const cProject& project = projects[i];
-    Clone(report, project);
-  }
+bool cUploader::Upload(const string_t& sSpoolFilePath) const
+{
+  spitfire::network::http::cRequest request;
+  request.SetMethodPost();
+  request.SetHost(spitfire::string::ToString_t(sHostUTF8));
+  request.SetPath(spitfire::string::ToString_t(sPathUTF8));
+  if (!sSecretUTF8.empty()) request.AddFormData("secret", sSecretUTF8);
+  request.AddFormData("encoding", "gzip");
+  request.AddPostFileFromPath("file", sSpoolFilePath);
+
+  spitfire::network::http::cHTTP http;
+  http.SendRequest(request);
+  return http.IsSuccessful();
+}
 
-  // Add an entry for each project to the report
-  for (size_t i = 0; i < nProjects; i++) {
-    const cProject& project = projects[i];
+// The number of failed attempts and the time of the next attempt are kept next to each spooled file in a ".retry" file
+bool cUploader::IsDue(const string_t& sSpoolFilePath) const
+{
+  std::ifstream file(spitfire::string::ToUTF8(sSpoolFilePath + TEXT(".retry")).c_str());
+  uint64_t attempts = 0;
+  uint64_t nextAttempt = 0;
+  if (!(file>>attempts>>nextAttempt)) return true;
 
-    const size_t nTargets = project.targets.size();
-    for (size_t iTarget = 0; iTarget < nTargets; iTarget++) {
-      const cTarget& target = project.targets[iTarget];
-      if (IsJavaTarget(project, target)) {
-        report.AddTest(project.sName, target.sName, TEXT("ant build"));
-      } else {
-        report.AddTest(project.sName, target.sName, TEXT("cmake"));
-        report.AddTest(project.sName, target.sName, TEXT("make"));
+  return (nextAttempt <= uint64_t(time(nullptr)));
+}
+
+// The spooled files that are due to be uploaded, oldest first
+void cUploader::GetDueFiles(std::vector<string_t>& files) const
+{
+  files.clear();
+
+  DIR* pDirectory = opendir(spitfire::string::ToUTF8(sSpoolFolder).c_str());
+  if (pDirectory != nullptr) {
+    const std::string sExtension = ".json.gz";
+    for (const dirent* pEntry = readdir(pDirectory); pEntry != nullptr; pEntry = readdir(pDirectory)) {
+      const std::string sName = pEntry->d_name;
+      if ((sName.length() > sExtension.length()) && (sName.compare(sName.length() - sExtension.length(), sExtension.length(), sExtension) == 0)) {
+        const string_t sSpoolFilePath = spitfire::filesystem::MakeFilePath(sSpoolFolder, spitfire::string::ToString_t(sName));
+        if (IsDue(sSpoolFilePath)) files.push_back(sSpoolFilePath);
       }
     }
+    closedir(pDirectory);
   }
+  std::sort(files.begin(), files.end());
+}
 
-  // If cloning was successful then we are ready to build and test our projects
-  if (!bIsError) {
-    LOG<<TEXT("Building and Testing Projects")<<std::endl;
-    // Compile and test all projects
-    for (size_t i = 0; i < nProjects; i++) {
-      const cProject& project = projects[i];
-      Build(report, project);
-      //Test(report, project);
-    };
+void cUploader::SetUploadFailed(const string_t& sSpoolFilePath) const
+{
+  const std::string sRetryFilePath = spitfire::string::ToUTF8(sSpoolFilePath + TEXT(".retry"));
+
+  uint64_t attempts = 0;
+  uint64_t nextAttempt = 0;
+  {
+    std::ifstream file(sRetryFilePath.c_str());
+    if (!(file>>attempts>>nextAttempt)) attempts = 0;
+  }
+
+  attempts++;
+  uint64_t delaySeconds = retryDelaySeconds << std::min<uint64_t>(attempts - 1, 20);
+  if (delaySeconds > maxRetryDelaySeconds) delaySeconds = maxRetryDelaySeconds;
+  nextAttempt = uint64_t(time(nullptr)) + delaySeconds;
+
+  std::ofstream file(sRetryFilePath.c_str(), std::ios::out | std::ios::trunc);
+  file<<attempts<<" "<<nextAttempt<<std::endl;
+
+  LOGERROR<<TEXT("cUploader::Run Failed to upload \"")<<sSpoolFilePath<<TEXT("\" (Attempt ")<<attempts<<TEXT("), it will be retried in ")<<delaySeconds<<TEXT(" seconds or later")<<std::endl;
+}
+
+// The thread keeps running for as long as the uploader is kept, in the daemon that is between builds, so when it has nothing to do it looks
+// in the spool folder every retryDelaySeconds for failed uploads that are due to be retried
+void cUploader::Run()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    if (!condition.wait_for(lock, std::chrono::seconds(uint64_t(retryDelaySeconds)), [&]() { return (!queue.empty() || bFinishing); })) {
+      lock.unlock();
+      std::vector<string_t> files;
+      GetDueFiles(files);
+      lock.lock();
+
+      for (size_t i = 0; i < files.size(); i++) {
+        if (std::find(queue.begin(), queue.end(), files[i]) == queue.end()) queue.push_back(files[i]);
+      }
+      continue;
+    }
+    if (queue.empty()) break;
+
+    const string_t sSpoolFilePath = queue.front();
+    queue.pop_front();
+
+    lock.unlock();
+    // A file that Add queued can also have been found in the spool folder, so it may already have been uploaded
+    if (spitfire::filesystem::FileExists(sSpoolFilePath)) {
+      if (Upload(sSpoolFilePath)) {
+        LOG<<TEXT("cUploader::Run Uploaded \"")<<sSpoolFilePath<<TEXT("\"")<<std::endl;
+        std::remove(spitfire::string::ToUTF8(sSpoolFilePath).c_str());
+        std::remove(spitfire::string::ToUTF8(sSpoolFilePath + TEXT(".retry")).c_str());
+      } else SetUploadFailed(sSpoolFilePath);
+    }
+    lock.lock();
   }
 }
 
+
+class cConfig;
+
 class cApplication : public spitfire::cConsoleApplication
 {
 public:
@@ -1014,12 +4966,47 @@ private:
 
   string_t GetBuildXMLFilePath() const;
 
+  string_t GetHistoryFilePath() const;
+  string_t GetSpoolFolderPath() const;
+
   void ListAllProjects();
+  void WriteGraph(const string_t& sFilePath);
   void BuildAllProjects();
+  void RunDaemon();
+  void PrintHistory();
+
+  void ConfigureBuildManager(cBuildManager& manager, const cConfig& config) const;
+  void BuildAndReport(cBuildManager& manager, const cConfig& config, cResultsWriter& resultsWriter, cUploader& uploader, const std::vector<string_t>& remoteRevisions) const;
+
+  size_t nJobs;
+  size_t nCloneJobs;
+  size_t nCompileJobs;
+  size_t nTestJobs;
+  size_t nTestTimeoutSeconds;
+  bool bFailFast;
+  string_t sGenerator;
+  bool bUseFingerprints;
+  size_t nPollIntervalSeconds;
+  bool bIsVerbose;
+
+  std::vector<string_t> selectionPatterns;
+  bool bSelectDependencies;
+  bool bSelectDependents;
 };
 
 cApplication::cApplication(int argc, const char* const* argv) :
-  spitfire::cConsoleApplication(argc, argv)
+  spitfire::cConsoleApplication(argc, argv),
+  nJobs(1),
+  nCloneJobs(8),
+  nCompileJobs(0),
+  nTestJobs(0),
+  nTestTimeoutSeconds(600),
+  bFailFast(false),
+  bUseFingerprints(true),
+  nPollIntervalSeconds(60),
+  bIsVerbose(false),
+  bSelectDependencies(false),
+  bSelectDependents(false)
 {
 }
 
@@ -1033,6 +5020,16 @@ string_t cApplication::GetBuildXMLFilePath() const
   return spitfire::filesystem::MakeFilePath(spitfire::filesystem::GetHomeConfigurationFilesDirectory(), GetApplicationName(), TEXT("build.xml"));
 }
 
+string_t cApplication::GetHistoryFilePath() const
+{
+  return spitfire::filesystem::MakeFilePath(spitfire::filesystem::GetHomeConfigurationFilesDirectory(), GetApplicationName(), TEXT("history.tsv"));
+}
+
+string_t cApplication::GetSpoolFolderPath() const
+{
+  return spitfire::filesystem::MakeFilePath(spitfire::filesystem::GetHomeConfigurationFilesDirectory(), GetApplicationName(), TEXT("spool"));
+}
+
 void cApplication::_PrintHelp() const
 {
   const string_t sXMLFilePath = GetBuildXMLFilePath();
@@ -1041,7 +5038,26 @@ void cApplication::_PrintHelp() const
   std::cout<<std::endl;
   std::cout<<"  -b, -build, --build  build a list of projects specified in "<<spitfire::string::ToUTF8(sXMLFilePath)<<std::endl;
   std::cout<<"  -l, -list, --list    list the projects specified in "<<spitfire::string::ToUTF8(sXMLFilePath)<<std::endl;
+  std::cout<<"  --history            show how long each step has taken over the previous runs and flag the steps that have regressed"<<std::endl;
+  std::cout<<"  --graph FILE         write the dependencies between the projects to FILE as a Graphviz dot file"<<std::endl;
+  std::cout<<"  --daemon             stay running, poll each project's remote and build the projects that have changed and their dependents"<<std::endl;
+  std::cout<<std::endl;
+  std::cout<<"  -j N, --jobs N       build up to N targets at once, each as soon as its project's dependencies have built"<<std::endl;
+  std::cout<<"  --clone-jobs N       clone up to N projects at once (Default is 8)"<<std::endl;
+  std::cout<<"  --compile-jobs N     run up to N compile jobs at once in total across every make (Default is the number of cores)"<<std::endl;
+  std::cout<<"  --test-jobs N        run up to N unit test applications at once (Default is the number of cores)"<<std::endl;
+  std::cout<<"  --test-timeout N     kill a unit test application and everything it started after N seconds (Default is 600)"<<std::endl;
+  std::cout<<"  --generator NAME     generate the C++ targets for ninja or make (Default is ninja 1.13 or later if it is installed, otherwise make)"<<std::endl;
+  std::cout<<"  --fail-fast          stop every build and test that is running as soon as one fails, and don't start any more"<<std::endl;
+  std::cout<<"  --no-cache           build every project, even if it and its dependencies haven't changed since they last passed"<<std::endl;
+  std::cout<<"  --interval N         with --daemon, poll the remotes every N seconds (Default is 60)"<<std::endl;
+  std::cout<<std::endl;
+  std::cout<<"  --only PATTERN       only clone, build and report the projects or targets whose names match PATTERN, such as \"Test*\""<<std::endl;
+  std::cout<<"                       (May be given more than once)"<<std::endl;
+  std::cout<<"  --with-deps          with --only, also select every project that the selected projects depend on"<<std::endl;
+  std::cout<<"  --with-dependents    with --only, also select every project that depends on the selected projects"<<std::endl;
   std::cout<<std::endl;
+  std::cout<<"  -v, --verbose        print each project and target as build.xml is read"<<std::endl;
   std::cout<<"  -help, --help        display this help and exit"<<std::endl;
   std::cout<<"  -version, --version  output version information and exit"<<std::endl;
 }
@@ -1060,6 +5076,8 @@ void cApplication::ListAllProjects()
 
   {
     cBuildManager manager(GetBuildXMLFilePath());
+    manager.SetVerbose(bIsVerbose);
+    manager.SetSelection(selectionPatterns, bSelectDependencies, bSelectDependents);
 
     manager.ListAllProjects(report);
   }
@@ -1074,6 +5092,15 @@ void cApplication::ListAllProjects()
   }
 }
 
+void cApplication::WriteGraph(const string_t& sFilePath)
+{
+  cBuildManager manager(GetBuildXMLFilePath());
+  manager.SetVerbose(bIsVerbose);
+  manager.SetSelection(selectionPatterns, bSelectDependencies, bSelectDependents);
+
+  manager.WriteGraph(sFilePath);
+}
+
 class cConfig
 {
 public:
@@ -1085,6 +5112,17 @@ public:
   const std::string& GetPathUTF8() const { return sPathUTF8; }
   const std::string& GetSecretUTF8() const { return sSecretUTF8; }
 
+  const string_t& GetWorkspaceFolder() const { return sWorkspaceFolder; }
+  const string_t& GetMirrorFolder() const { return sMirrorFolder; }
+  const string_t& GetCompilerCacheFolder() const { return sCompilerCacheFolder; }
+  const string_t& GetCompilerCacheMaxSize() const { return sCompilerCacheMaxSize; }
+
+  size_t GetHistoryThresholdPercent() const { return nHistoryThresholdPercent; }
+  size_t GetHistoryBaselineRuns() const { return nHistoryBaselineRuns; }
+
+  size_t GetMemoryPressurePercent() const { return nMemoryPressurePercent; }
+  size_t GetCPUPressurePercent() const { return nCPUPressurePercent; }
+
 private:
   void Clear();
 
@@ -1093,11 +5131,23 @@ private:
   std::string sHostUTF8;
   std::string sPathUTF8;
   std::string sSecretUTF8;
+
+  string_t sWorkspaceFolder;
+  string_t sMirrorFolder;
+  string_t sCompilerCacheFolder;
+  string_t sCompilerCacheMaxSize;
+
+  size_t nHistoryThresholdPercent;
+  size_t nHistoryBaselineRuns;
+
+  size_t nMemoryPressurePercent;
+  size_t nCPUPressurePercent;
 };
 
 cConfig::cConfig(const cApplication& _application) :
   application(_application)
 {
+  Clear();
 }
 
 void cConfig::Clear()
@@ -1105,6 +5155,17 @@ void cConfig::Clear()
   sHostUTF8.clear();
   sPathUTF8.clear();
   sSecretUTF8.clear();
+
+  sWorkspaceFolder.clear();
+  sMirrorFolder.clear();
+  sCompilerCacheFolder.clear();
+  sCompilerCacheMaxSize.clear();
+
+  nHistoryThresholdPercent = 50;
+  nHistoryBaselineRuns = 7;
+
+  nMemoryPressurePercent = 10;
+  nCPUPressurePercent = 80;
 }
 
 void cConfig::Load()
@@ -1138,6 +5199,11 @@ void cConfig::Load()
 
   //<config>
   //  <account host="chris.iluo.net" path="/tests/index.php" secret="secret"/>
+  //  <workspace path="/home/chris/buildall"/>
+  //  <mirror path="/home/chris/buildall_mirror"/>
+  //  <ccache path="/home/chris/buildall_ccache" size="20G"/>
+  //  <history threshold="50" baseline="7"/>
+  //  <pressure memory="10" cpu="80"/>
   //</config>
 
   iterAccount.FindChild("config");
@@ -1146,6 +5212,61 @@ void cConfig::Load()
     return;
   }
 
+  {
+    spitfire::document::cNode::iterator iterWorkspace(iterAccount);
+    iterWorkspace.FindChild("workspace");
+    if (iterWorkspace.IsValid()) {
+      if (!iterWorkspace.GetAttribute("path", sWorkspaceFolder)) {
+        LOGERROR<<TEXT("config.xml contains a workspace without a path")<<std::endl;
+        return;
+      }
+    }
+  }
+
+  {
+    spitfire::document::cNode::iterator iterMirror(iterAccount);
+    iterMirror.FindChild("mirror");
+    if (iterMirror.IsValid()) {
+      if (!iterMirror.GetAttribute("path", sMirrorFolder)) {
+        LOGERROR<<TEXT("config.xml contains a mirror without a path")<<std::endl;
+        return;
+      }
+    }
+  }
+
+  {
+    spitfire::document::cNode::iterator iterCompilerCache(iterAccount);
+    iterCompilerCache.FindChild("ccache");
+    if (iterCompilerCache.IsValid()) {
+      if (!iterCompilerCache.GetAttribute("path", sCompilerCacheFolder)) {
+        LOGERROR<<TEXT("config.xml contains a ccache without a path")<<std::endl;
+        return;
+      }
+
+      iterCompilerCache.GetAttribute("size", sCompilerCacheMaxSize);
+    }
+  }
+
+  {
+    spitfire::document::cNode::iterator iterHistory(iterAccount);
+    iterHistory.FindChild("history");
+    if (iterHistory.IsValid()) {
+      std::string sValue;
+      if (iterHistory.GetAttribute("threshold", sValue)) nHistoryThresholdPercent = size_t(std::max(0, atoi(sValue.c_str())));
+      if (iterHistory.GetAttribute("baseline", sValue)) nHistoryBaselineRuns = size_t(std::max(1, atoi(sValue.c_str())));
+    }
+  }
+
+  {
+    spitfire::document::cNode::iterator iterPressure(iterAccount);
+    iterPressure.FindChild("pressure");
+    if (iterPressure.IsValid()) {
+      std::string sValue;
+      if (iterPressure.GetAttribute("memory", sValue)) nMemoryPressurePercent = size_t(std::max(0, atoi(sValue.c_str())));
+      if (iterPressure.GetAttribute("cpu", sValue)) nCPUPressurePercent = size_t(std::max(0, atoi(sValue.c_str())));
+    }
+  }
+
   iterAccount.FindChild("account");
   if (iterAccount.IsValid()) {
     if (!iterAccount.GetAttribute("host", sHostUTF8)) {
@@ -1165,138 +5286,271 @@ void cConfig::Load()
   }
 }
 
-void cApplication::BuildAllProjects()
+void cApplication::PrintHistory()
+{
+  cConfig config(*this);
+  config.Load();
+
+  cHistory history(GetHistoryFilePath());
+  history.SetThresholdPercent(config.GetHistoryThresholdPercent());
+  history.SetBaselineRuns(config.GetHistoryBaselineRuns());
+  history.PrintTrends();
+}
+
+void cApplication::ConfigureBuildManager(cBuildManager& manager, const cConfig& config) const
+{
+  manager.SetJobs(nJobs);
+  manager.SetCloneJobs(nCloneJobs);
+  if (nCompileJobs != 0) manager.SetCompileJobs(nCompileJobs);
+  if (nTestJobs != 0) manager.SetTestJobs(nTestJobs);
+  manager.SetTestTimeoutSeconds(nTestTimeoutSeconds);
+  manager.SetFailFast(bFailFast);
+  manager.SetGenerator(sGenerator);
+  manager.SetPressureThresholds(config.GetMemoryPressurePercent(), config.GetCPUPressurePercent());
+  manager.SetWorkspaceFolder(config.GetWorkspaceFolder());
+  manager.SetMirrorFolder(config.GetMirrorFolder());
+  manager.SetCompilerCache(config.GetCompilerCacheFolder(), config.GetCompilerCacheMaxSize());
+  manager.SetLogFolder(spitfire::filesystem::MakeFilePath(spitfire::filesystem::GetHomeDirectory(), TEXT("buildall_logs")));
+  manager.SetFingerprintsFilePath(spitfire::filesystem::MakeFilePath(spitfire::filesystem::GetHomeConfigurationFilesDirectory(), GetApplicationName(), TEXT("fingerprints.txt")));
+  manager.SetUseFingerprints(bUseFingerprints);
+  manager.SetVerbose(bIsVerbose);
+  manager.SetSelection(selectionPatterns, bSelectDependencies, bSelectDependents);
+}
+
+// Builds the projects and then writes, records and queues the results of the build for uploading
+void cApplication::BuildAndReport(cBuildManager& manager, const cConfig& config, cResultsWriter& resultsWriter, cUploader& uploader, const std::vector<string_t>& remoteRevisions) const
 {
   cReport report;
 
-  {
-    cBuildManager manager(GetBuildXMLFilePath());
+  // Write the results of each project as soon as it finishes
+  const string_t sFilePath = spitfire::filesystem::MakeFilePath(spitfire::filesystem::GetHomeDirectory(), TEXT("results.json"));
+  resultsWriter.Open(sFilePath, spitfire::filesystem::MakeFilePath(spitfire::filesystem::GetHomeDirectory(), TEXT("results.jsonl")));
+
+  manager.BuildAllProjects(report, remoteRevisions);
 
-    manager.BuildAllProjects(report);
+  resultsWriter.Close(report);
+
+  // Add this run to the history and warn about any steps that have become much slower
+  {
+    cHistory history(GetHistoryFilePath());
+    history.SetThresholdPercent(config.GetHistoryThresholdPercent());
+    history.SetBaselineRuns(config.GetHistoryBaselineRuns());
+    history.AppendRun(report);
+    history.PrintRegressions();
   }
 
 
-  spitfire::json::cDocument document;
+  // Post the results to http://chris.iluo.net/buildall
+  uploader.Add(sFilePath);
+}
+
+void cApplication::BuildAllProjects()
+{
+  // Read host, path, secret and workspace from .config/buildall/config.xml
+  cConfig config(*this);
+  config.Load();
+
+  cResultsWriter resultsWriter;
+
+  // Publish live progress events
+  cEventServer eventServer;
+  eventServer.Open(spitfire::filesystem::MakeFilePath(spitfire::filesystem::GetHomeConfigurationFilesDirectory(), GetApplicationName(), TEXT("events.sock")));
 
-  // Create the json tree for the report
   {
-    spitfire::json::cNode* pDocumentNode = &document;
-    pDocumentNode->SetTypeObject();
+    cBuildManager manager(GetBuildXMLFilePath());
+    ConfigureBuildManager(manager, config);
+    manager.AddObserver(&resultsWriter);
+    manager.AddObserver(&eventServer);
 
-    spitfire::json::cNode* pProjectsNode = document.CreateNode("projects");
-    pDocumentNode->AppendChild(pProjectsNode);
-    pProjectsNode->SetTypeArray();
+    // Upload results in the background, starting with any that earlier runs failed to upload
+    cUploader uploader(GetSpoolFolderPath(), config.GetHostUTF8(), config.GetPathUTF8(), config.GetSecretUTF8());
+    uploader.Start();
 
-    const std::vector<cReportProject*>& projects = report.GetProjects();
-    const size_t nProjects = projects.size();
-    for (size_t iProject = 0; iProject < nProjects; iProject++) {
-      const cReportProject& project = *projects[iProject];
-      spitfire::json::cNode* pProjectNode = document.CreateNode();
-      pProjectsNode->AppendChild(pProjectNode);
-      pProjectNode->SetTypeObject();
-      pProjectNode->SetAttribute("name", project.GetName());
-
-      // Project results
-      {
-        spitfire::json::cNode* pProjectResults = document.CreateNode("results");
-        pProjectNode->AppendChild(pProjectResults);
-        pProjectResults->SetTypeArray();
-
-        const std::vector<cReportResult*>& results = project.GetResults();
-        const size_t nResults = results.size();
-        for (size_t iResult = 0; iResult < nResults; iResult++) {
-          const cReportResult& result = *results[iResult];
-          spitfire::json::cNode* pResultNode = document.CreateNode();
-          pProjectResults->AppendChild(pResultNode);
-          pResultNode->SetTypeObject();
-          assert(!result.GetName().empty());
-          pResultNode->SetAttribute("name", result.GetName());
-          if (result.IsNotRun()) pResultNode->SetAttribute("status", TEXT("notrun"));
-          else if (result.IsPassed()) pResultNode->SetAttribute("status", TEXT("passed"));
-          else pResultNode->SetAttribute("status", TEXT("failed"));
-        }
-      }
+    BuildAndReport(manager, config, resultsWriter, uploader, std::vector<string_t>());
 
-      // Target results
-      {
-        spitfire::json::cNode* pTargetResults = document.CreateNode("targets");
-        pProjectNode->AppendChild(pTargetResults);
-        pTargetResults->SetTypeArray();
-
-        const std::vector<cReportTarget*>& targets = project.GetTargets();
-        const size_t nTargets = targets.size();
-        for (size_t iTarget = 0; iTarget < nTargets; iTarget++) {
-          const cReportTarget& target = *targets[iTarget];
-          spitfire::json::cNode* pTargetNode = document.CreateNode();
-          pTargetResults->AppendChild(pTargetNode);
-          pTargetNode->SetTypeObject();
-          pTargetNode->SetAttribute("name", target.GetName());
-
-          spitfire::json::cNode* pResultsNode = document.CreateNode();
-          pTargetNode->AppendChild(pResultsNode);
-          pResultsNode->SetTypeArray();
-          pResultsNode->SetName("results");
-
-          const std::vector<cReportResult*>& results = target.GetResults();
-          const size_t nResults = results.size();
-          for (size_t iResult = 0; iResult < nResults; iResult++) {
-            const cReportResult& result = *results[iResult];
-            spitfire::json::cNode* pResultNode = document.CreateNode();
-            pResultsNode->AppendChild(pResultNode);
-            pResultNode->SetTypeObject();
-            assert(!result.GetName().empty());
-            pResultNode->SetAttribute("name", result.GetName());
-            if (result.IsNotRun()) pResultNode->SetAttribute("status", TEXT("notrun"));
-            else if (result.IsPassed()) pResultNode->SetAttribute("status", TEXT("passed"));
-            else pResultNode->SetAttribute("status", TEXT("failed"));
-          }
-        }
-      }
-    }
+    uploader.Finish();
   }
 
-  const string_t sFilePath = spitfire::filesystem::MakeFilePath(spitfire::filesystem::GetHomeDirectory(), TEXT("results.json"));
+  eventServer.Close();
+}
+
+namespace
+{
+  volatile sig_atomic_t bIsStopRequested = 0;
 
-  // Write the json to a file
+  void OnStopSignal(int)
   {
-    spitfire::json::writer writer;
+    bIsStopRequested = 1;
+  }
+}
+
+// Stays running and builds whenever the revision of any project's remote moves
+// build.xml and config.xml are only read and the tools only checked once, and the checkouts and build trees are kept in the workspace
+// between builds, so only the projects that changed and the projects that depend on them are updated and built again
+// SIGINT or SIGTERM stop the daemon once the current build has finished
+void cApplication::RunDaemon()
+{
+  cConfig config(*this);
+  config.Load();
+
+  cResultsWriter resultsWriter;
 
-    writer.WriteToFile(document, sFilePath);
+  cEventServer eventServer;
+  eventServer.Open(spitfire::filesystem::MakeFilePath(spitfire::filesystem::GetHomeConfigurationFilesDirectory(), GetApplicationName(), TEXT("events.sock")));
+
+  cBuildManager manager(GetBuildXMLFilePath());
+  ConfigureBuildManager(manager, config);
+  manager.AddObserver(&resultsWriter);
+  manager.AddObserver(&eventServer);
+
+  // Incremental builds need somewhere to keep the checkouts between builds
+  if (config.GetWorkspaceFolder().empty()) manager.SetWorkspaceFolder(spitfire::filesystem::MakeFilePath(spitfire::filesystem::GetHomeConfigurationFilesDirectory(), GetApplicationName(), TEXT("workspace")));
+
+  if (!manager.LoadProjects()) {
+    eventServer.Close();
+    return;
   }
 
-  // Post json file to http://chris.iluo.net/buildall
-  {
-    // Read host, path and secret from .config/buildall/config.xml
-    cConfig config(*this);
-    config.Load();
+  signal(SIGINT, OnStopSignal);
+  signal(SIGTERM, OnStopSignal);
+
+  LOG<<TEXT("cApplication::RunDaemon Polling every ")<<nPollIntervalSeconds<<TEXT(" seconds")<<std::endl;
+
+  // One uploader for the life of the daemon, so that failed uploads are retried in the background between builds instead of each build
+  // waiting for its upload
+  cUploader uploader(GetSpoolFolderPath(), config.GetHostUTF8(), config.GetPathUTF8(), config.GetSecretUTF8());
+  uploader.Start();
+
+  std::vector<string_t> lastRevisions;
+  while (!bIsStopRequested) {
+    std::vector<string_t> revisions;
+    manager.GetRemoteRevisions(revisions);
 
-    if (!config.GetHostUTF8().empty() && !config.GetPathUTF8().empty()) {
-      spitfire::network::http::cRequest request;
-      request.SetMethodPost();
-      request.SetHost(spitfire::string::ToString_t(config.GetHostUTF8()));
-      request.SetPath(spitfire::string::ToString_t(config.GetPathUTF8()));
-      if (!config.GetSecretUTF8().empty()) request.AddFormData("secret", config.GetSecretUTF8());
-      request.AddPostFileFromPath("file", sFilePath);
+    // A remote that couldn't be reached hasn't moved as far as we know
+    bool bChanged = lastRevisions.empty();
+    for (size_t i = 0; (i < revisions.size()) && !bChanged; i++) {
+      if (!revisions[i].empty() && (revisions[i] != lastRevisions[i])) bChanged = true;
+    }
+
+    if (bChanged) {
+      LOG<<TEXT("cApplication::RunDaemon Remote revisions have changed, building")<<std::endl;
+      BuildAndReport(manager, config, resultsWriter, uploader, revisions);
 
-      spitfire::network::http::cHTTP http;
-      http.SendRequest(request);
-      bool bResult = http.IsSuccessful();
-      std::cout<<"Result="<<bResult<<std::endl;
+      // Keep the previous revision of any remote we couldn't reach so that we still notice when it moves
+      // NOTE: A project that failed or was skipped is remembered at this revision too so that it isn't built again on every poll, it has no
+      // fingerprint so the next build, once a remote moves, tries it again
+      for (size_t i = 0; i < revisions.size(); i++) {
+        if (revisions[i].empty() && !lastRevisions.empty()) revisions[i] = lastRevisions[i];
+      }
+      lastRevisions = revisions;
     }
+
+    for (size_t i = 0; (i < nPollIntervalSeconds) && !bIsStopRequested; i++) std::this_thread::sleep_for(std::chrono::seconds(1));
   }
+
+  LOG<<TEXT("cApplication::RunDaemon Stopping")<<std::endl;
+
+  uploader.Finish();
+
+  eventServer.Close();
 }
 
 bool cApplication::_Run()
 {
   string_t sError;
 
+  enum class MODE {
+    NONE,
+    BUILD,
+    LIST,
+    HISTORY,
+    GRAPH,
+    DAEMON
+  };
+  MODE mode = MODE::NONE;
+  string_t sGraphFilePath;
+
   const size_t n = GetArgumentCount();
-  if (n != 1) sError = TEXT("Invalid number of arguments");
-  else {
-    const string_t& sArgument = GetArgument(0);
-    if ((sArgument == TEXT("-b")) || (sArgument == TEXT("-build")) || (sArgument == TEXT("--build"))) BuildAllProjects();
-    else if ((sArgument == TEXT("-l")) || (sArgument == TEXT("-list")) || (sArgument == TEXT("--list"))) ListAllProjects();
-    else sError = TEXT("Unknown argument \"") + sArgument + TEXT("\"");
+  for (size_t i = 0; (i < n) && sError.empty(); i++) {
+    const string_t& sArgument = GetArgument(i);
+    if ((sArgument == TEXT("-b")) || (sArgument == TEXT("-build")) || (sArgument == TEXT("--build"))) {
+      if (mode != MODE::NONE) sError = TEXT("Invalid number of arguments");
+      mode = MODE::BUILD;
+    } else if ((sArgument == TEXT("-l")) || (sArgument == TEXT("-list")) || (sArgument == TEXT("--list"))) {
+      if (mode != MODE::NONE) sError = TEXT("Invalid number of arguments");
+      mode = MODE::LIST;
+    } else if (sArgument == TEXT("--history")) {
+      if (mode != MODE::NONE) sError = TEXT("Invalid number of arguments");
+      mode = MODE::HISTORY;
+    } else if (sArgument == TEXT("--graph")) {
+      if (mode != MODE::NONE) sError = TEXT("Invalid number of arguments");
+      mode = MODE::GRAPH;
+      i++;
+      if ((i >= n) || GetArgument(i).empty()) sError = TEXT("Argument \"") + sArgument + TEXT("\" requires a file path");
+      else sGraphFilePath = GetArgument(i);
+    } else if (sArgument == TEXT("--daemon")) {
+      if (mode != MODE::NONE) sError = TEXT("Invalid number of arguments");
+      mode = MODE::DAEMON;
+    } else if ((sArgument == TEXT("-j")) || (sArgument == TEXT("--jobs"))) {
+      i++;
+      const int iJobs = (i < n) ? atoi(spitfire::string::ToUTF8(GetArgument(i)).c_str()) : 0;
+      if (iJobs <= 0) sError = TEXT("Argument \"") + sArgument + TEXT("\" requires a number of jobs");
+      else nJobs = size_t(iJobs);
+    } else if (sArgument == TEXT("--no-cache")) {
+      bUseFingerprints = false;
+    } else if (sArgument == TEXT("--fail-fast")) {
+      bFailFast = true;
+    } else if (sArgument == TEXT("--generator")) {
+      i++;
+      if ((i >= n) || ((GetArgument(i) != TEXT("ninja")) && (GetArgument(i) != TEXT("make")))) sError = TEXT("Argument \"") + sArgument + TEXT("\" requires ninja or make");
+      else sGenerator = GetArgument(i);
+    } else if (sArgument == TEXT("--compile-jobs")) {
+      i++;
+      const int iJobs = (i < n) ? atoi(spitfire::string::ToUTF8(GetArgument(i)).c_str()) : 0;
+      if (iJobs <= 0) sError = TEXT("Argument \"") + sArgument + TEXT("\" requires a number of jobs");
+      else nCompileJobs = size_t(iJobs);
+    } else if (sArgument == TEXT("--test-jobs")) {
+      i++;
+      const int iJobs = (i < n) ? atoi(spitfire::string::ToUTF8(GetArgument(i)).c_str()) : 0;
+      if (iJobs <= 0) sError = TEXT("Argument \"") + sArgument + TEXT("\" requires a number of jobs");
+      else nTestJobs = size_t(iJobs);
+    } else if (sArgument == TEXT("--test-timeout")) {
+      i++;
+      const int iSeconds = (i < n) ? atoi(spitfire::string::ToUTF8(GetArgument(i)).c_str()) : 0;
+      if (iSeconds <= 0) sError = TEXT("Argument \"") + sArgument + TEXT("\" requires a number of seconds");
+      else nTestTimeoutSeconds = size_t(iSeconds);
+    } else if (sArgument == TEXT("--clone-jobs")) {
+      i++;
+      const int iJobs = (i < n) ? atoi(spitfire::string::ToUTF8(GetArgument(i)).c_str()) : 0;
+      if (iJobs <= 0) sError = TEXT("Argument \"") + sArgument + TEXT("\" requires a number of jobs");
+      else nCloneJobs = size_t(iJobs);
+    } else if (sArgument == TEXT("--interval")) {
+      i++;
+      const int iSeconds = (i < n) ? atoi(spitfire::string::ToUTF8(GetArgument(i)).c_str()) : 0;
+      if (iSeconds <= 0) sError = TEXT("Argument \"") + sArgument + TEXT("\" requires a number of seconds");
+      else nPollIntervalSeconds = size_t(iSeconds);
+    } else if (sArgument == TEXT("--only")) {
+      i++;
+      if ((i >= n) || GetArgument(i).empty()) sError = TEXT("Argument \"") + sArgument + TEXT("\" requires a project or target name");
+      else selectionPatterns.push_back(GetArgument(i));
+    } else if ((sArgument == TEXT("-v")) || (sArgument == TEXT("--verbose"))) {
+      bIsVerbose = true;
+    } else if (sArgument == TEXT("--with-deps")) {
+      bSelectDependencies = true;
+    } else if (sArgument == TEXT("--with-dependents")) {
+      bSelectDependents = true;
+    } else sError = TEXT("Unknown argument \"") + sArgument + TEXT("\"");
+  }
+
+  if (sError.empty() && selectionPatterns.empty() && (bSelectDependencies || bSelectDependents)) sError = TEXT("--with-deps and --with-dependents require --only");
+
+  if (sError.empty()) {
+    if (mode == MODE::BUILD) BuildAllProjects();
+    else if (mode == MODE::LIST) ListAllProjects();
+    else if (mode == MODE::HISTORY) PrintHistory();
+    else if (mode == MODE::GRAPH) WriteGraph(sGraphFilePath);
+    else if (mode == MODE::DAEMON) RunDaemon();
+    else sError = TEXT("Invalid number of arguments");
   }
 
   if (!sError.empty()) {